@@ -3,7 +3,6 @@
 #include "utils.hpp"
 
 #include <chrono>
-#include <thread>
 #include <signal.h>
 
 //#define DEBUG
@@ -30,14 +29,72 @@ void print_help() {
   printf(" -h --help                   get help on usage at start\n");
   printf(" -v --version                show version and exits\n");
   printf(" -c --calibration            force calibration at start\n");
+  printf("    --polar-calibration      force calibration at start, also recording "
+         "the shape of the stick gates. Improves diagonals on worn or non-round gates\n");
+  printf("    --transport TRANSPORT    hidapi library used to open the controller: "
+         "auto (default, libusb for USB and hidraw for Bluetooth), libusb, hidraw or "
+         "libusb-async (USB only, needs a build with PROCON_USB_ASYNC)\n");
+  printf("    --auto-calibration       skip the calibration step and learn the "
+         "range of the sticks while playing. 'share' and 'home' switch to the "
+         "manual calibration\n");
+  printf("    --track-drift            follow the resting position of the sticks "
+         "and update the calibration while the controller is idle\n");
+  printf("    --pipeline               read, process and send on separate threads, "
+         "so a slow step never delays reading the controller\n");
+  printf("    --output-rate HZ         send the gamepad events at a fixed rate "
+         "(e.g. 250, 500 or 1000) instead of with each report. 0 (default) "
+         "sends them as soon as a report arrives\n");
   printf(" -s --swap-buttons           Swap A and B buttons and X and Y "
           "buttons\n");
   printf("    --swap-ab                Swap A and B buttons\n");
   printf("    --swap-xy                Swap X and Y buttons\n");
   printf(" -i --invert-axis [AXIS]     invert axis, possible axis: lx, ly, "
           "rx, ry, dx, dy\n");
+  printf("    --deadzone [l|r] [INNER] [OUTER]\n"
+         "                             Stick deadzones, in percent. Applies to "
+         "both sticks unless l or r is given\n");
+  printf("    --deadzone-shape [l|r] [SHAPE]\n"
+         "                             radial (default) or axial\n");
+  printf("    --anti-deadzone [l|r] [PERCENT]\n"
+         "                             Smallest output once out of the deadzone\n");
+  printf("    --curve [l|r] [CURVE]    Stick response curve: linear, power:EXP, "
+         "scurve:K or points:X:Y,X:Y,... (X and Y in [0, 1])\n");
+  printf("    --filter [CUTOFF] [BETA] Smooth stick jitter with a One Euro filter. "
+         "CUTOFF in Hz (default 1), BETA speed coefficient (default 0.007)\n");
+  printf("    --predict [HORIZON] [CLAMP]\n"
+         "                             Extrapolate the sticks between reports, "
+         "needs --output-rate. HORIZON in ms (default 15), CLAMP in percent of "
+         "the range (default 10)\n");
+  printf("    --record FILE            Save the stick values of each report to FILE\n");
+  printf("    --replay FILE            Replay a recording through the predictor, "
+         "print its error and exit\n");
   printf(" -p --print-state [TYPE]     Enables printing the state of TYPE. "
-         "Possible TYPEs: a (axis), b (buttons), d (dpad)\n");
+         "Possible TYPEs: a (axis), b (buttons), d (dpad), m (motion)\n");
+  printf(" -m --motion-sensors         Expose the accelerometer and gyroscope "
+         "as a separate motion sensors device\n");
+  printf("    --gyro-mouse [SENS]      Move a virtual mouse with the gyro. SENS "
+         "is in pixels per degree (default 10)\n");
+  printf("    --gyro-mouse-accel [MAX_SENS] [SPEED]\n"
+         "                             Ramp the sensitivity up to MAX_SENS when "
+         "turning at SPEED degrees per second\n");
+  printf("    --gyro-mouse-ratchet [BUTTON]\n"
+         "                             Pause the gyro mouse while BUTTON is held "
+         "(e.g. R1, L3)\n");
+  printf("    --gyro-mouse-rate [HZ]   Smooth the mouse motion by sending it at "
+         "HZ (up to 1000) instead of once per report\n");
+  printf("    --motion-stick [gyro|tilt]\n"
+         "                             Mix the gyro rate (default) or the tilt "
+         "into a stick\n");
+  printf("    --motion-stick-axes [X] [Y]\n"
+         "                             Axis driven by the motion, default rx ry\n");
+  printf("    --motion-stick-range [DEG]\n"
+         "                             Degrees per second (gyro, default 180) or "
+         "degrees (tilt, default 30) for full deflection. Negative inverts\n");
+  printf("    --motion-stick-deadzone [DEG]\n"
+         "                             Ignore motion below DEG (default 2)\n");
+  printf("    --motion-stick-saturation [PERCENT]\n"
+         "                             Limit the motion to PERCENT of the stick "
+         "range (default 100)\n");
 #ifdef DRIBBLE_MODE
   printf(" -d [VALUE]                  Enables dribble mode. If a parameter is"
          " given, it is used as the dribble cam value. Range 0 to 255\n");
@@ -59,6 +116,32 @@ void print_header(){
 }
 
 
+/// Runs the stick predictor over a recording, without a controller.
+int replay_recording(const Config &config) {
+  std::vector<Sticks::Sample> samples;
+  try {
+    samples = Sticks::load_recording(config.replay_path);
+  }
+  catch (const std::exception &e) {
+    Utils::PrintColor::red(stderr, ("Can't load the recording: " + std::string(e.what()) + "\n").c_str());
+    return -1;
+  }
+
+  Sticks::PredictorSettings settings = config.prediction_settings();
+  Sticks::ReplayResult result = Sticks::replay(samples, settings);
+  Utils::PrintColor::cyan();
+  printf("Replayed %lu reports, %.2f ms apart on average (%.2f ms max).\n",
+         (unsigned long)result.samples, result.report_interval.mean(), result.report_interval.max);
+  printf("Prediction with a %.1f ms horizon and a %.0f counts clamp:\n",
+         settings.horizon * 1000.0, settings.clamp);
+  printf("  holding the last report: %.2f counts average error, %.0f max\n",
+         result.held_error.mean(), result.held_error.max);
+  printf("  extrapolating:           %.2f counts average error, %.0f max\n",
+         result.predicted_error.mean(), result.predicted_error.max);
+  Utils::PrintColor::normal();
+  return 0;
+}
+
 void handle_controller(const HidApi::Enumerate &iter, Config &config) {
   unsigned short n_controller = 0;
 
@@ -66,6 +149,9 @@ void handle_controller(const HidApi::Enumerate &iter, Config &config) {
 
   Utils::PrintColor::green();
   printf("Opened controller!\n");
+  if (controller.resumed_session()) {
+    Utils::PrintColor::cyan(stdout, "The controller was still in HID only mode, skipped the handshake.\n");
+  }
 
   if (!controller.needs_first_calibration()) {
     controller.calibrate_from_file();
@@ -73,6 +159,18 @@ void handle_controller(const HidApi::Enumerate &iter, Config &config) {
     Utils::PrintColor::cyan(stdout, "Press 'share' and 'home' to calibrate again or start with --calibrate or -c.\n");
     Utils::PrintColor::green(stdout, "Now entering input mode!\n");
   }
+  else if (!config.force_calibration && config.auto_calibration) {
+    controller.calibrate_automatically();
+    Utils::PrintColor::green(stdout, "Learning the range of the sticks while playing! ");
+    Utils::PrintColor::cyan(stdout, "Move both sticks to their maximum positions once for full range. "
+                                    "Press 'share' and 'home' to calibrate manually instead.\n");
+    Utils::PrintColor::green(stdout, "Now entering input mode!\n");
+  }
+  else if (!config.force_calibration && controller.calibrate_from_controller()) {
+    Utils::PrintColor::green(stdout, "Using the calibration stored in the controller! ");
+    Utils::PrintColor::cyan(stdout, "Press 'share' and 'home' to calibrate manually or start with --calibrate or -c.\n");
+    Utils::PrintColor::green(stdout, "Now entering input mode!\n");
+  }
 
   printf("\n");
 
@@ -86,6 +184,8 @@ void handle_controller(const HidApi::Enumerate &iter, Config &config) {
     printf("\r\e[K");*/
 
     if (!controller.is_calibrated()) {
+      /// The calibration reads the controller directly.
+      controller.stop_pipeline();
       Utils::PrintColor::blue(stdout, "Starting calibration mode.\n");
       Utils::PrintColor::cyan(stdout, "Move both control sticks to their maximum positions "
             "(i.e. turn them in a circle once slowly.).\n"
@@ -107,7 +207,11 @@ void handle_controller(const HidApi::Enumerate &iter, Config &config) {
                                        "Calibrated Controller! Now entering input mode!\n");
     }
 
-    controller.poll_input(delta_milis);
+    if (config.pipeline) {
+      controller.poll_pipeline(delta_milis);
+    } else {
+      controller.poll_input(delta_milis);
+    }
 
     if (config.print_axis) {
       controller.print_sticks();
@@ -119,16 +223,34 @@ void handle_controller(const HidApi::Enumerate &iter, Config &config) {
     if (config.print_dpad) {
       controller.print_dpad();
     }
-    if (config.print_axis || config.print_buttons || config.print_dpad) {
+    if (config.print_imu) {
+      controller.print_imu();
+    }
+    if (config.print_axis || config.print_buttons || config.print_dpad || config.print_imu) {
       fflush(stdout);
       printf("\r\e[K");
     }
 
-    auto frame_end = std::chrono::steady_clock::now();
-    std::this_thread::sleep_for(std::chrono::microseconds((1000 * 1000 / 120)) - (frame_end-frame_start));
+    /// The pipeline already waits for the next report.
+    if (!config.pipeline) {
+      controller.wait_until(frame_start + std::chrono::microseconds(1000 * 1000 / 120));
+    }
 
     last_start = frame_start;
   }
+
+  controller.stop_pipeline();
+  controller.print_transport_stats();
+  controller.print_tx_stats();
+  controller.print_io_stats();
+  controller.print_ff_stats();
+  controller.print_output_stats();
+  if (config.pipeline) {
+    controller.print_pipeline_stats();
+  }
+  if (config.stick_filter) {
+    controller.print_filter_stats();
+  }
 }
 
 
@@ -147,6 +269,10 @@ int main(int argc, char *argv[]) {
 
   print_header();
 
+  if (!config.replay_path.empty()) {
+    return replay_recording(config);
+  }
+
   if (config.found_dribble_cam_value) {
     Utils::PrintColor::cyan();
     printf("Dribble mode enabled!\n");
@@ -168,7 +294,7 @@ int main(int argc, char *argv[]) {
 
   try {
     // Don't trust hidapi, returns non-matching devices sometimes
-    HidApi::Enumerate iter(NINTENDO_ID, PROCON_ID);
+    HidApi::Enumerate iter(NINTENDO_ID, PROCON_ID, config.transport);
     handle_controller(iter, config);
   }
   catch (const HidApi::EnumerateError &e) {
@@ -184,6 +310,11 @@ int main(int argc, char *argv[]) {
     Utils::PrintColor::yellow(stdout, "You could try running with sudo.\n");
     Utils::PrintColor::red(stderr, ("  " + std::string(e.what()) + "\n").c_str());
   }
+  catch (const RealController::InitError &e) {
+    Utils::PrintColor::yellow(stdout, "The controller didn't answer during the initialization.\n");
+    Utils::PrintColor::magenta(stdout, "Try unplugging and plugging again the usb to the controller.\n");
+    Utils::PrintColor::red(stderr, ("  " + std::string(e.what()) + "\n").c_str());
+  }
   catch (const std::exception &e) {
     Utils::PrintColor::red(stdout, "Unexpected error.\n");
     Utils::PrintColor::red(stderr, ("  " + std::string(e.what()) + "\n").c_str());
@@ -0,0 +1,20 @@
+#include "calibration_store.hpp"
+using namespace Calibration;
+
+#include <cstring>
+
+
+Record Record::make(const std::string &key) {
+  Record record;
+  memset(&record, 0, sizeof(record));
+  record.key = Store::make_key(key);
+  return record;
+}
+
+std::string Record::name() const {
+  return std::string(key.data(), strnlen(key.data(), key.size()));
+}
+
+bool Record::has(uint32_t flag) const {
+  return (flags & flag) != 0;
+}
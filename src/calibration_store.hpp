@@ -0,0 +1,49 @@
+#pragma once
+#ifndef PRO__CALIBRATION_STORE_HPP
+#define PRO__CALIBRATION_STORE_HPP
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include "real_controller_calibration.hpp"
+#include "record_store.hpp"
+#include "sticks.hpp"
+
+namespace Calibration {
+  /// Calibration of one controller. Fixed size, so it's stored as is.
+  struct Record {
+    /// Serial number or MAC of the controller, NUL padded.
+    std::array<char, 32> key;
+    uint32_t flags;
+
+    std::array<uint16_t, 4> axis_min;
+    std::array<uint16_t, 4> axis_max;
+    std::array<uint16_t, 4> axis_cen;
+
+    /// Center and radii of each polar profile (left, right).
+    std::array<std::array<uint16_t, 2>, 2> polar_center;
+    std::array<std::array<uint16_t, Sticks::PolarProfile::bins>, 2> polar_radii;
+
+    /// Used when the controller can't give its own.
+    RealController::ImuCalibrationData imu;
+
+    static constexpr uint32_t has_sticks      {1 << 0};
+    static constexpr uint32_t has_polar_left  {1 << 1};
+    static constexpr uint32_t has_polar_right {1 << 2};
+    static constexpr uint32_t has_imu         {1 << 3};
+
+    static constexpr std::array<char, 4> magic{'P', 'C', 'C', 'S'};
+    static constexpr uint16_t version{1};
+
+    /// Empty record for @param key.
+    static Record make(const std::string &key);
+
+    std::string name() const;
+    bool has(uint32_t flag) const;
+  };
+
+  /// Calibrations of every controller, in a single versioned file.
+  using Store = Utils::RecordStore<Record>;
+};
+
+#endif
@@ -4,14 +4,23 @@
 
 // #define DRIBBLE_MODE // game-specific hack. does not belong here!
 
+#include <array>
 #include <cstring>
 #include <string>
 #include <stdexcept>
+#include "hidapi_backend.hpp"
+#include "sticks.hpp"
 
 class Config{
 public:
   bool help = false;
   bool force_calibration = false;
+  bool polar_calibration = false;
+  bool track_drift = false;
+  bool auto_calibration = false;
+  HidApi::Transport transport = HidApi::Transport::transport_auto;
+  bool pipeline = false;
+  unsigned int output_rate = 0; /// Hz. 0 sends the gamepad events with each report.
   bool show_version = false;
   bool invert_lx = false;
   bool invert_ly = true;
@@ -25,6 +34,36 @@ public:
   bool print_axis = false;
   bool print_buttons = false;
   bool print_dpad = false;
+  bool print_imu = false;
+  bool motion_sensors = false;
+
+  bool gyro_mouse = false;
+  double gyro_mouse_sensitivity = 10.0; /// Pixels per degree.
+  double gyro_mouse_max_sensitivity = 10.0;
+  double gyro_mouse_accel_speed = 0.0; /// Degrees per second. 0 disables acceleration.
+  std::string gyro_mouse_ratchet = "";
+  unsigned int gyro_mouse_rate = 0; /// Hz. 0 sends the motion with each report.
+
+  bool motion_stick = false;
+  bool motion_stick_tilt = false;
+  std::string motion_stick_x = "rx";
+  std::string motion_stick_y = "ry";
+  double motion_stick_range = 0.0; /// 0 uses the default of the source.
+  double motion_stick_deadzone = 2.0;
+  double motion_stick_saturation = 1.0;
+
+  /// Left and right stick.
+  std::array<Sticks::StickProfile, 2> stick_profiles;
+
+  bool stick_filter = false;
+  double stick_filter_min_cutoff = 1.0; /// Hz.
+  double stick_filter_beta = 0.007;
+
+  bool stick_prediction = false;
+  double stick_prediction_horizon = 15.0; /// Milliseconds.
+  double stick_prediction_clamp = 0.1; /// Fraction of the axis range.
+  std::string record_path = "";
+  std::string replay_path = "";
 
   int dribble_cam_value = 205;
   bool found_dribble_cam_value = false;
@@ -37,6 +76,37 @@ public:
       else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--calibration")) {
         force_calibration = true;
       }
+      else if (!strcmp(argv[i], "--polar-calibration")) {
+        force_calibration = true;
+        polar_calibration = true;
+      }
+      else if (!strcmp(argv[i], "--transport")) {
+        if (i + 1 >= argc || !HidApi::parse_transport(argv[i + 1], transport)) {
+          throw std::invalid_argument("Expected transport parameter (auto, libusb, hidraw or libusb-async). Use --help for options!");
+        }
+        ++i;
+      }
+      else if (!strcmp(argv[i], "--auto-calibration")) {
+        auto_calibration = true;
+      }
+      else if (!strcmp(argv[i], "--track-drift")) {
+        track_drift = true;
+      }
+      else if (!strcmp(argv[i], "--pipeline")) {
+        pipeline = true;
+      }
+      else if (!strcmp(argv[i], "--output-rate")) {
+        if (i + 1 >= argc) {
+          throw std::invalid_argument("Expected rate parameter. Use --help for options!");
+        }
+        int rate = std::stoi(argv[++i]);
+        if (rate < 0 || rate > 1000) {
+          throw std::domain_error("Output rate out of range. "
+                                  "Expected value in [0, 1000], got "
+                                  + std::to_string(rate) + ".");
+        }
+        output_rate = rate;
+      }
       else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--version")) {
         show_version = true;
       }
@@ -71,6 +141,175 @@ public:
       else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--swap-buttons")) {
         swap_buttons = true;
       }
+      else if (!strcmp(argv[i], "-m") || !strcmp(argv[i], "--motion-sensors")) {
+        motion_sensors = true;
+      }
+      else if (!strcmp(argv[i], "--gyro-mouse")) {
+        gyro_mouse = true;
+        if (i+1 < argc && isdigit(argv[i+1][0])) {
+          i++;
+          gyro_mouse_sensitivity = std::stod(argv[i]);
+        }
+      }
+      else if (!strcmp(argv[i], "--gyro-mouse-accel")) {
+        if (i + 2 >= argc) {
+          throw std::invalid_argument("Expected max sensitivity and speed parameters. Use --help for options!");
+        }
+        gyro_mouse_max_sensitivity = std::stod(argv[++i]);
+        gyro_mouse_accel_speed = std::stod(argv[++i]);
+        if (gyro_mouse_accel_speed <= 0) {
+          throw std::domain_error("Gyro mouse acceleration speed must be positive.");
+        }
+      }
+      else if (!strcmp(argv[i], "--gyro-mouse-ratchet")) {
+        if (i + 1 >= argc) {
+          throw std::invalid_argument("Expected button parameter. Use --help for options!");
+        }
+        gyro_mouse_ratchet = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--gyro-mouse-rate")) {
+        if (i + 1 >= argc) {
+          throw std::invalid_argument("Expected rate parameter. Use --help for options!");
+        }
+        int rate = std::stoi(argv[++i]);
+        if (rate < 0 || rate > 1000) {
+          throw std::domain_error("Gyro mouse rate out of range. "
+                                  "Expected value in [0, 1000], got "
+                                  + std::to_string(rate) + ".");
+        }
+        gyro_mouse_rate = rate;
+      }
+      else if (!strcmp(argv[i], "--motion-stick")) {
+        motion_stick = true;
+        if (i + 1 < argc && !strcmp(argv[i+1], "tilt")) {
+          motion_stick_tilt = true;
+          ++i;
+        } else if (i + 1 < argc && !strcmp(argv[i+1], "gyro")) {
+          ++i;
+        }
+      }
+      else if (!strcmp(argv[i], "--motion-stick-axes")) {
+        if (i + 2 >= argc) {
+          throw std::invalid_argument("Expected two axis parameters. Use --help for options!");
+        }
+        motion_stick_x = argv[++i];
+        motion_stick_y = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--motion-stick-range")) {
+        if (i + 1 >= argc) {
+          throw std::invalid_argument("Expected range parameter. Use --help for options!");
+        }
+        motion_stick_range = std::stod(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "--motion-stick-deadzone")) {
+        if (i + 1 >= argc) {
+          throw std::invalid_argument("Expected deadzone parameter. Use --help for options!");
+        }
+        motion_stick_deadzone = std::stod(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "--motion-stick-saturation")) {
+        if (i + 1 >= argc) {
+          throw std::invalid_argument("Expected saturation parameter. Use --help for options!");
+        }
+        int percent = std::stoi(argv[++i]);
+        if (percent < 0 || percent > 100) {
+          throw std::domain_error("Motion stick saturation out of range. "
+                                  "Expected value in [0, 100], got "
+                                  + std::to_string(percent) + ".");
+        }
+        motion_stick_saturation = percent / 100.0;
+      }
+      else if (!strcmp(argv[i], "--deadzone")) {
+        std::array<bool, 2> sticks = parse_stick_selector(argc, argv, i);
+        if (i + 1 >= argc) {
+          throw std::invalid_argument("Expected deadzone parameter. Use --help for options!");
+        }
+        double inner = parse_percent(argv[++i]);
+        double outer = 1.0;
+        if (i + 1 < argc && isdigit(argv[i+1][0])) {
+          outer = parse_percent(argv[++i]);
+        }
+        if (outer <= inner) {
+          throw std::domain_error("Outer deadzone must be bigger than the inner deadzone.");
+        }
+        for (size_t n = 0; n < sticks.size(); ++n) {
+          if (sticks[n]) {
+            stick_profiles[n].inner = inner;
+            stick_profiles[n].outer = outer;
+          }
+        }
+      }
+      else if (!strcmp(argv[i], "--deadzone-shape")) {
+        std::array<bool, 2> sticks = parse_stick_selector(argc, argv, i);
+        if (i + 1 >= argc) {
+          throw std::invalid_argument("Expected shape parameter. Use --help for options!");
+        }
+        ++i;
+        Sticks::DeadzoneShape shape;
+        if (!strcmp(argv[i], "radial")) {
+          shape = Sticks::DeadzoneShape::deadzone_radial;
+        } else if (!strcmp(argv[i], "axial")) {
+          shape = Sticks::DeadzoneShape::deadzone_axial;
+        } else {
+          throw std::invalid_argument("Unknown deadzone shape " + std::string(argv[i]) + ". Use --help for options!");
+        }
+        for (size_t n = 0; n < sticks.size(); ++n) {
+          if (sticks[n]) stick_profiles[n].shape = shape;
+        }
+      }
+      else if (!strcmp(argv[i], "--anti-deadzone")) {
+        std::array<bool, 2> sticks = parse_stick_selector(argc, argv, i);
+        if (i + 1 >= argc) {
+          throw std::invalid_argument("Expected anti-deadzone parameter. Use --help for options!");
+        }
+        double anti = parse_percent(argv[++i]);
+        for (size_t n = 0; n < sticks.size(); ++n) {
+          if (sticks[n]) stick_profiles[n].anti_deadzone = anti;
+        }
+      }
+      else if (!strcmp(argv[i], "--curve")) {
+        std::array<bool, 2> sticks = parse_stick_selector(argc, argv, i);
+        if (i + 1 >= argc) {
+          throw std::invalid_argument("Expected curve parameter. Use --help for options!");
+        }
+        ++i;
+        for (size_t n = 0; n < sticks.size(); ++n) {
+          if (sticks[n]) stick_profiles[n].set_curve(argv[i]);
+        }
+      }
+      else if (!strcmp(argv[i], "--filter")) {
+        stick_filter = true;
+        if (i + 1 < argc && isdigit(argv[i+1][0])) {
+          stick_filter_min_cutoff = std::stod(argv[++i]);
+          if (stick_filter_min_cutoff <= 0) {
+            throw std::domain_error("Filter cutoff must be positive.");
+          }
+          if (i + 1 < argc && isdigit(argv[i+1][0])) {
+            stick_filter_beta = std::stod(argv[++i]);
+          }
+        }
+      }
+      else if (!strcmp(argv[i], "--predict")) {
+        stick_prediction = true;
+        if (i + 1 < argc && isdigit(argv[i+1][0])) {
+          stick_prediction_horizon = std::stod(argv[++i]);
+          if (i + 1 < argc && isdigit(argv[i+1][0])) {
+            stick_prediction_clamp = parse_percent(argv[++i]);
+          }
+        }
+      }
+      else if (!strcmp(argv[i], "--record")) {
+        if (i + 1 >= argc) {
+          throw std::invalid_argument("Expected file parameter. Use --help for options!");
+        }
+        record_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--replay")) {
+        if (i + 1 >= argc) {
+          throw std::invalid_argument("Expected file parameter. Use --help for options!");
+        }
+        replay_path = argv[++i];
+      }
       else if (!strcmp(argv[i], "--swap-ab")) {
         swap_ab = true;
       }
@@ -90,6 +329,8 @@ public:
             print_buttons = true;
           } else if (!strcmp(argv[i+1], "d")) {
             print_dpad = true;
+          } else if (!strcmp(argv[i+1], "m")) {
+            print_imu = true;
           } else {
             valid_parameter = false;
           }
@@ -120,6 +361,36 @@ public:
 
   }
 
+  Sticks::PredictorSettings prediction_settings() const {
+    Sticks::PredictorSettings settings;
+    settings.horizon = stick_prediction_horizon / 1000.0;
+    settings.clamp = stick_prediction_clamp * Sticks::axis_max;
+    return settings;
+  }
+
+private:
+  /// Optional `l` or `r` after an option. Both sticks if it's missing.
+  static std::array<bool, 2> parse_stick_selector(int argc, char *argv[], int &i) {
+    if (i + 1 < argc && !strcmp(argv[i+1], "l")) {
+      ++i;
+      return {true, false};
+    }
+    if (i + 1 < argc && !strcmp(argv[i+1], "r")) {
+      ++i;
+      return {false, true};
+    }
+    return {true, true};
+  }
+
+  static double parse_percent(const char *arg) {
+    double value = std::stod(arg);
+    if (value < 0 || value > 100) {
+      throw std::domain_error("Percentage out of range. "
+                              "Expected value in [0, 100], got "
+                              + std::string(arg) + ".");
+    }
+    return value / 100.0;
+  }
 };
 
 #endif
@@ -0,0 +1,107 @@
+#include "hidapi_backend.hpp"
+using namespace HidApi;
+
+#include <dlfcn.h>
+#include <array>
+#include <optional>
+#include "hidapi_wrapper.hpp"
+
+static std::array<std::optional<Backend>, 3> backends;
+
+
+const char *HidApi::transport_name(Transport transport) {
+  switch (transport) {
+  case Transport::transport_auto:   return "auto";
+  case Transport::transport_libusb: return "libusb";
+  case Transport::transport_hidraw: return "hidraw";
+  case Transport::transport_usb_async: return "libusb-async";
+  }
+  return "unknown";
+}
+
+bool HidApi::parse_transport(const std::string &name, Transport &transport) {
+  for (Transport candidate: {Transport::transport_auto, Transport::transport_libusb, Transport::transport_hidraw,
+                             Transport::transport_usb_async}) {
+    if (name == transport_name(candidate)) {
+      transport = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+template <typename Function>
+static bool load_symbol(void *handle, const char *name, Function &function) {
+  function = reinterpret_cast<Function>(dlsym(handle, name));
+  return function != nullptr;
+}
+
+static std::optional<Backend> load_backend(Transport transport, const std::array<const char *, 2> &names) {
+  void *handle = nullptr;
+  for (const char *name: names) {
+    /// Local, so the symbols of both libraries don't clash.
+    handle = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+    if (handle != nullptr) {
+      break;
+    }
+  }
+  if (handle == nullptr) {
+    return std::nullopt;
+  }
+
+  Backend backend;
+  backend.transport = transport;
+  backend.handle = handle;
+  bool loaded = load_symbol(handle, "hid_init", backend.init)
+             && load_symbol(handle, "hid_exit", backend.exit)
+             && load_symbol(handle, "hid_enumerate", backend.enumerate)
+             && load_symbol(handle, "hid_free_enumeration", backend.free_enumeration)
+             && load_symbol(handle, "hid_open", backend.open)
+             && load_symbol(handle, "hid_open_path", backend.open_path)
+             && load_symbol(handle, "hid_close", backend.close)
+             && load_symbol(handle, "hid_write", backend.write)
+             && load_symbol(handle, "hid_read", backend.read)
+             && load_symbol(handle, "hid_read_timeout", backend.read_timeout)
+             && load_symbol(handle, "hid_set_nonblocking", backend.set_nonblocking)
+             && load_symbol(handle, "hid_get_manufacturer_string", backend.get_manufacturer_string)
+             && load_symbol(handle, "hid_get_product_string", backend.get_product_string)
+             && load_symbol(handle, "hid_get_serial_number_string", backend.get_serial_number_string)
+             && load_symbol(handle, "hid_get_indexed_string", backend.get_indexed_string)
+             && load_symbol(handle, "hid_error", backend.error);
+  if (!loaded || backend.init() < 0) {
+    dlclose(handle);
+    return std::nullopt;
+  }
+  return backend;
+}
+
+void HidApi::load_backends() {
+  backends[Transport::transport_libusb] = load_backend(Transport::transport_libusb, {"libhidapi-libusb.so.0", "libhidapi-libusb.so"});
+  backends[Transport::transport_hidraw] = load_backend(Transport::transport_hidraw, {"libhidapi-hidraw.so.0", "libhidapi-hidraw.so"});
+  if (!backends[Transport::transport_libusb] && !backends[Transport::transport_hidraw]) {
+    throw InitError("InitError: Neither libhidapi-libusb nor libhidapi-hidraw could be loaded.");
+  }
+}
+
+void HidApi::unload_backends() {
+  bool failed = false;
+  for (std::optional<Backend> &loaded: backends) {
+    if (loaded) {
+      failed = loaded->exit() < 0 || failed;
+      dlclose(loaded->handle);
+      loaded.reset();
+    }
+  }
+  if (failed) {
+    throw ExitError("ExitError: Hid exit error");
+  }
+}
+
+const Backend *HidApi::backend(Transport transport) {
+  if (transport == Transport::transport_auto || transport == Transport::transport_usb_async) {
+    const Backend *libusb = backend(Transport::transport_libusb);
+    return libusb != nullptr ? libusb : backend(Transport::transport_hidraw);
+  }
+  return backends[transport] ? &*backends[transport] : nullptr;
+}
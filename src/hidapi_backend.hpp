@@ -0,0 +1,62 @@
+#pragma once
+#ifndef HIDAPI_BACKEND__HPP
+#define HIDAPI_BACKEND__HPP
+
+#include <hidapi/hidapi.h>
+
+#include <string>
+
+
+namespace HidApi{
+  /// hidapi library used to talk to a device.
+  enum Transport {
+    transport_auto,   /// libusb if it finds the device, hidraw otherwise.
+    transport_libusb, /// USB only.
+    transport_hidraw, /// USB and Bluetooth.
+    transport_usb_async, /// USB only, libusb async API without hidapi. See AsyncUsbDevice.
+  };
+
+  const char *transport_name(Transport transport);
+  /// @return false if @param name isn't a known transport.
+  bool parse_transport(const std::string &name, Transport &transport);
+
+  /**
+   * @brief Entry points of one hidapi library.
+   *
+   * Both libraries export the same symbols, so they can't be linked together.
+   * Each one is loaded with dlopen instead, and the devices keep a pointer to
+   * the backend they were found with.
+   */
+  struct Backend {
+    Transport transport;
+    void *handle;
+
+    decltype(&::hid_init) init;
+    decltype(&::hid_exit) exit;
+    decltype(&::hid_enumerate) enumerate;
+    decltype(&::hid_free_enumeration) free_enumeration;
+    decltype(&::hid_open) open;
+    decltype(&::hid_open_path) open_path;
+    decltype(&::hid_close) close;
+    decltype(&::hid_write) write;
+    decltype(&::hid_read) read;
+    decltype(&::hid_read_timeout) read_timeout;
+    decltype(&::hid_set_nonblocking) set_nonblocking;
+    decltype(&::hid_get_manufacturer_string) get_manufacturer_string;
+    decltype(&::hid_get_product_string) get_product_string;
+    decltype(&::hid_get_serial_number_string) get_serial_number_string;
+    decltype(&::hid_get_indexed_string) get_indexed_string;
+    decltype(&::hid_error) error;
+  };
+
+  /// Loads and initializes every installed backend.
+  void load_backends();
+  void unload_backends();
+
+  /// nullptr if the library of @param transport isn't installed.
+  /// transport_auto returns the first available one, as does transport_usb_async,
+  /// which only uses hidapi to find the device.
+  const Backend *backend(Transport transport);
+};
+
+#endif
@@ -1,7 +1,11 @@
 #include "hidapi_wrapper.hpp"
 using namespace HidApi;
 
+#include <chrono>
 #include <cstring>
+#include <cwchar>
+#include <fstream>
+#include <thread>
 #include "utils.hpp"
 
 constexpr size_t maxlen = 1024;
@@ -20,24 +24,24 @@ HidApiError::HidApiError(const char* what_arg): std::runtime_error(what_arg) {
   std::string aux = std::string("HidApi: ") + what_arg;
   Utils::Str::copy_string_to_char(str, aux);
 }
-HidApiError::HidApiError(hid_device *ptr): std::runtime_error("") {
-  const wchar_t *er = hid_error(ptr);
+HidApiError::HidApiError(const Backend *backend, hid_device *ptr): std::runtime_error("") {
+  const wchar_t *er = backend->error(ptr);
   if (er == nullptr) {
     Utils::Str::copy_string_to_char(str, "HidApi: Unknown error");
     return;
   }
   Utils::Str::copy_string_to_char(str, std::string("HidApi: ") + Utils::Str::wide_to_string(er));
 }
-HidApiError::HidApiError(hid_device *ptr, const std::string& what_arg): std::runtime_error(what_arg) {
-  const wchar_t *er = hid_error(ptr);
+HidApiError::HidApiError(const Backend *backend, hid_device *ptr, const std::string& what_arg): std::runtime_error(what_arg) {
+  const wchar_t *er = backend->error(ptr);
   if (er == nullptr) {
     Utils::Str::copy_string_to_char(str, std::string("HidApi: ") + what_arg);
     return;
   }
   Utils::Str::copy_string_to_char(str, std::string("HidApi: ") + what_arg + "\n" + Utils::Str::wide_to_string(er));
 }
-HidApiError::HidApiError(hid_device *ptr, const char* what_arg): std::runtime_error(what_arg) {
-  const wchar_t *er = hid_error(ptr);
+HidApiError::HidApiError(const Backend *backend, hid_device *ptr, const char* what_arg): std::runtime_error(what_arg) {
+  const wchar_t *er = backend->error(ptr);
   if (er == nullptr) {
     Utils::Str::copy_string_to_char(str, std::string("HidApi: ") + what_arg);
     return;
@@ -58,24 +62,95 @@ const char *HidApiError::what() const noexcept {
 }
 
 
-Enumerate::Enumerate(uint16_t vendor_id, uint16_t product_id) {
-  ptr = hid_enumerate(vendor_id, product_id);
-  if (ptr == nullptr) {
+namespace {
+  bool on_bluetooth(const struct hid_device_info *info, const Backend *backend) {
+    if (backend->transport != Transport::transport_hidraw) {
+      return false;
+    }
+    /// The bus is the first field of HID_ID, 0005 for Bluetooth.
+    std::string path(info->path);
+    std::string node = path.substr(path.find_last_of('/') + 1);
+    std::ifstream uevent("/sys/class/hidraw/" + node + "/device/uevent");
+    std::string line;
+    while (std::getline(uevent, line)) {
+      if (line.rfind("HID_ID=", 0) == 0) {
+        return line.compare(7, 4, "0005") == 0;
+      }
+    }
+    /// Without sysfs, only Bluetooth devices have the MAC as serial number.
+    return info->serial_number != nullptr && Utils::Str::wide_to_string(info->serial_number).find(':') != std::string::npos;
+  }
+
+  bool same_serial(const struct hid_device_info *a, const struct hid_device_info *b) {
+    const wchar_t *sa = a->serial_number != nullptr ? a->serial_number : L"";
+    const wchar_t *sb = b->serial_number != nullptr ? b->serial_number : L"";
+    return std::wcscmp(sa, sb) == 0;
+  }
+}
+
+Enumerate::Enumerate(uint16_t vendor_id, uint16_t product_id, Transport transport): requested(transport) {
+  std::array<Transport, 2> candidates{transport, transport};
+  if (transport == Transport::transport_auto || transport == Transport::transport_usb_async) {
+    candidates = {Transport::transport_libusb, Transport::transport_hidraw};
+  }
+  for (size_t i = 0; i < lists.size(); ++i) {
+    libs[i] = HidApi::backend(candidates[i]);
+    if (libs[i] == nullptr || (i > 0 && candidates[i] == candidates[0])) {
+      libs[i] = nullptr;
+      continue;
+    }
+    lists[i] = libs[i]->enumerate(vendor_id, product_id);
+  }
+
+  /// libusb is preferred for USB pads, hidraw is the only one that sees Bluetooth pads.
+  /// A USB pad is seen by both, so the hidraw entry is dropped when libusb has the same serial.
+  /// Within one backend paths are unique, USB pads may all share the same serial.
+  for (size_t i = 0; i < lists.size(); ++i) {
+    for (struct hid_device_info *info = lists[i]; info != nullptr; info = info->next) {
+      bool wireless = on_bluetooth(info, libs[i]);
+      bool duplicated = false;
+      for (const Found &other: found) {
+        if (other.lib == libs[i]) {
+          duplicated = duplicated || std::strcmp(other.info->path, info->path) == 0;
+        } else {
+          duplicated = duplicated || (!wireless && same_serial(other.info, info));
+        }
+      }
+      if (!duplicated) {
+        found.push_back({info, libs[i]});
+      }
+    }
+  }
+  if (found.empty()) {
     throw EnumerateError("EnumerateError: Unable to find any requested device.");
   }
+  ptr = found.front().info;
+  lib = found.front().lib;
 }
 Enumerate::Enumerate(Enumerate &&other) noexcept: ptr(nullptr) {
   std::swap(ptr, other.ptr);
+  std::swap(lib, other.lib);
+  std::swap(lists, other.lists);
+  std::swap(libs, other.libs);
+  std::swap(found, other.found);
+  std::swap(requested, other.requested);
 }
 
 Enumerate::~Enumerate() noexcept {
-  if (ptr != nullptr) {
-    hid_free_enumeration(ptr);
+  for (size_t i = 0; i < lists.size(); ++i) {
+    if (lists[i] != nullptr) {
+      libs[i]->free_enumeration(lists[i]);
+    }
   }
 }
 
 Enumerate &Enumerate::operator=(Enumerate &&other) noexcept {
   std::swap(ptr, other.ptr);
+  std::swap(lib, other.lib);
+  std::swap(lists, other.lists);
+  std::swap(libs, other.libs);
+  std::swap(found, other.found);
+  std::swap(requested, other.requested);
   return *this;
 }
 
@@ -84,47 +159,86 @@ const struct hid_device_info *Enumerate::device_info() const noexcept {
   return ptr;
 }
 
+const Backend *Enumerate::backend() const noexcept {
+  return lib;
+}
+
+Transport Enumerate::transport() const noexcept {
+  return requested;
+}
+
+size_t Enumerate::count() const noexcept {
+  return found.size();
+}
 
-Device::Device(const struct hid_device_info *device_info) {
-  ptr = hid_open_path(device_info->path);
+bool Enumerate::bluetooth() const {
+  return on_bluetooth(ptr, lib);
+}
+
+
+Device::Device(const struct hid_device_info *device_info, const Backend *backend): lib(backend) {
+  ptr = lib->open_path(device_info->path);
   if (ptr == nullptr) {
-    throw OpenError(ptr, "OpenError: open_path()");
+    throw OpenError(lib, ptr, "OpenError: open_path()");
   }
 }
-Device::Device(const Enumerate &info): Device(info.device_info()) {
+Device::Device(const Enumerate &info): lib(info.backend()) {
+  if (info.transport() != Transport::transport_usb_async) {
+    ptr = lib->open_path(info.device_info()->path);
+    if (ptr == nullptr) {
+      throw OpenError(lib, ptr, "OpenError: open_path()");
+    }
+    return;
+  }
+  if (info.bluetooth()) {
+    throw OpenError("OpenError: libusb-async only supports USB controllers.");
+  }
+  native = std::make_unique<AsyncUsbDevice>(info.device_info()->vendor_id, info.device_info()->product_id);
 }
-Device::Device(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number) {
-  ptr = hid_open(vendor_id, product_id, serial_number);
+Device::Device(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number,
+               const Backend *backend): lib(backend) {
+  if (lib == nullptr) {
+    throw OpenError("OpenError: No hidapi backend loaded.");
+  }
+  ptr = lib->open(vendor_id, product_id, serial_number);
   if (ptr == nullptr) {
-    throw OpenError(ptr, "OpenError: open()");
+    throw OpenError(lib, ptr, "OpenError: open()");
   }
 }
 Device::Device(Device &&other) noexcept: ptr(nullptr) {
   std::swap(ptr, other.ptr);
+  std::swap(lib, other.lib);
+  std::swap(native, other.native);
   std::swap(blocking, other.blocking);
+  std::swap(latency, other.latency);
 }
 
 Device::~Device(){
   if (ptr != nullptr) {
-    hid_close(ptr);
+    lib->close(ptr);
     ptr = nullptr;
   }
 }
 
 Device &Device::operator=(Device &&other) noexcept {
   std::swap(ptr, other.ptr);
+  std::swap(lib, other.lib);
+  std::swap(native, other.native);
   std::swap(blocking, other.blocking);
+  std::swap(latency, other.latency);
   return *this;
 }
 
 
 size_t Device::write(size_t len, const uint8_t *data) {
-  int ret = hid_write(ptr, data, len);
+  auto start = std::chrono::steady_clock::now();
+  int ret = native ? static_cast<int>(native->write(len, data)) : lib->write(ptr, data, len);
+  latency.write.add(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
   if (ret < 0) {
-    throw WriteError(ptr, "WriteError: write() returned " + std::to_string(ret) + ".");
+    throw WriteError(lib, ptr, "WriteError: write() returned " + std::to_string(ret) + ".");
   }
   if (len != (size_t)ret) {
-    throw WriteError(ptr, "WriteError: Couldn't write " + std::to_string(len) + " bytes. Wrote " + std::to_string(ret) + " bytes instead.");
+    throw WriteError(lib, ptr, "WriteError: Couldn't write " + std::to_string(len) + " bytes. Wrote " + std::to_string(ret) + " bytes instead.");
   }
   return ret;
 }
@@ -133,15 +247,18 @@ size_t Device::write(size_t len, const uint8_t *data) {
 size_t Device::read(size_t len, uint8_t *data, int milliseconds) {
   int ret;
   memset(data, 0, len);
+  if (native) {
+    return native->read(len, data, (milliseconds < 0 && !blocking) ? 0 : milliseconds);
+  }
   if (milliseconds < 0) {
-    ret = hid_read(ptr, data, len);
+    ret = lib->read(ptr, data, len);
   }
   else {
-    ret = hid_read_timeout(ptr, data, len, milliseconds);
+    ret = lib->read_timeout(ptr, data, len, milliseconds);
   }
 
   if (ret < 0) {
-    throw ReadError(ptr, "ReadError: read() returned " + std::to_string(ret));
+    throw ReadError(lib, ptr, "ReadError: read() returned " + std::to_string(ret));
   }
   return ret;
 }
@@ -174,14 +291,14 @@ DefaultPacket Device::exchange(size_t write_len, const uint8_t *data_to_write, i
 
 
 void Device::set_non_blocking() {
-  if (hid_set_nonblocking(ptr, 1) < 0) {
+  if (!native && lib->set_nonblocking(ptr, 1) < 0) {
     throw StateChangeError("StateChangeError: Couldn't set non-blocking mode.");
   }
   blocking = false;
 }
 
 void Device::set_blocking() {
-  if (hid_set_nonblocking(ptr, 0) < 0) {
+  if (!native && lib->set_nonblocking(ptr, 0) < 0) {
     throw StateChangeError("StateChangeError: Couldn't set blocking mode.");
   }
   blocking = true;
@@ -191,34 +308,70 @@ bool Device::IsBlocking() const noexcept {
   return blocking;
 }
 
+Transport Device::transport() const noexcept {
+  return native ? Transport::transport_usb_async : lib->transport;
+}
+
+const LatencyStats &Device::stats() const noexcept {
+  return latency;
+}
+
+void Device::add_round_trip(double milliseconds) {
+  latency.round_trip.add(milliseconds);
+}
+
+const AsyncUsbStats *Device::async_stats() const noexcept {
+  return native ? &native->stats() : nullptr;
+}
+
+void Device::wait_until(std::chrono::steady_clock::time_point deadline) {
+  if (native) {
+    native->wait_until(deadline);
+  } else {
+    std::this_thread::sleep_until(deadline);
+  }
+}
+
 
 std::string Device::get_manufacturer() const {
+  if (native) {
+    return native->get_manufacturer();
+  }
   std::array<wchar_t, maxlen+1> buf;
-  if (hid_get_manufacturer_string(ptr, buf.data(), maxlen) < 0) {
+  if (lib->get_manufacturer_string(ptr, buf.data(), maxlen) < 0) {
     throw GetterError("GetterError: Couldn't get manufacturer string.");
   }
   return Utils::Str::wide_to_string(buf.data());
 }
 
 std::string Device::get_product() const {
+  if (native) {
+    return native->get_product();
+  }
   std::array<wchar_t, maxlen+1> buf;
-  if (hid_get_product_string(ptr, buf.data(), maxlen) < 0) {
+  if (lib->get_product_string(ptr, buf.data(), maxlen) < 0) {
     throw GetterError("GetterError: Couldn't get product string.");
   }
   return Utils::Str::wide_to_string(buf.data());
 }
 
 std::string Device::get_serial_number() const {
+  if (native) {
+    return native->get_serial_number();
+  }
   std::array<wchar_t, maxlen+1> buf;
-  if (hid_get_serial_number_string(ptr, buf.data(), maxlen) < 0) {
+  if (lib->get_serial_number_string(ptr, buf.data(), maxlen) < 0) {
     throw GetterError("GetterError: Couldn't get serial number string.");
   }
   return Utils::Str::wide_to_string(buf.data());
 }
 
 std::string Device::get_indexed(int string_index) const {
+  if (native) {
+    return native->get_string(string_index);
+  }
   std::array<wchar_t, maxlen+1> buf;
-  if (hid_get_indexed_string(ptr, string_index, buf.data(), maxlen) < 0) {
+  if (lib->get_indexed_string(ptr, string_index, buf.data(), maxlen) < 0) {
     throw GetterError("GetterError: Couldn't get ndexed string.");
   }
   return Utils::Str::wide_to_string(buf.data());
@@ -226,13 +379,9 @@ std::string Device::get_indexed(int string_index) const {
 
 
 void HidApi::init() {
-  if (hid_init() < 0) {
-    throw InitError("InitError: Hid init error");
-  }
+  load_backends();
 }
 
 void HidApi::exit() {
-  if (hid_exit() < 0) {
-    throw ExitError("ExitError: Hid exit error");
-  }
+  unload_backends();
 }
@@ -5,8 +5,14 @@
 #include <hidapi/hidapi.h>
 
 #include <array>
+#include <chrono>
+#include <memory>
 #include <string>
+#include <vector>
 #include <stdexcept>
+#include "hidapi_backend.hpp"
+#include "usb_async.hpp"
+#include "utils.hpp"
 
 
 namespace HidApi{
@@ -21,9 +27,9 @@ namespace HidApi{
     HidApiError();
     HidApiError(const std::string& what_arg);
     HidApiError(const char* what_arg);
-    HidApiError(hid_device *ptr);
-    HidApiError(hid_device *ptr, const std::string& what_arg);
-    HidApiError(hid_device *ptr, const char* what_arg);
+    HidApiError(const Backend *backend, hid_device *ptr);
+    HidApiError(const Backend *backend, hid_device *ptr, const std::string& what_arg);
+    HidApiError(const Backend *backend, hid_device *ptr, const char* what_arg);
 
     ~HidApiError();
 
@@ -65,7 +71,9 @@ namespace HidApi{
 
   class Enumerate{
   public:
-    Enumerate(uint16_t vendor_id, uint16_t product_id);
+    /// With transport_auto both backends are enumerated and each device gets its own:
+    /// libusb for USB pads, hidraw for Bluetooth ones. The first device found is selected.
+    Enumerate(uint16_t vendor_id, uint16_t product_id, Transport transport=Transport::transport_auto);
     Enumerate(const Enumerate &other) = delete;
     Enumerate(Enumerate &&other) noexcept;
 
@@ -75,19 +83,48 @@ namespace HidApi{
     Enumerate &operator=(Enumerate &&other) noexcept;
 
     const struct hid_device_info *device_info() const noexcept;
+    const Backend *backend() const noexcept;
+    /// The requested one, the backend may differ with transport_auto and transport_usb_async.
+    Transport transport() const noexcept;
+
+    /// Devices found, after removing the ones seen by both backends.
+    size_t count() const noexcept;
+
+    /// Bluetooth devices are only reachable through hidraw.
+    bool bluetooth() const;
 
     static constexpr uint16_t any_vendor{0};
     static constexpr uint16_t any_product{0};
 
   private:
-    struct hid_device_info *ptr = nullptr;
+    struct Found {
+      const struct hid_device_info *info;
+      const Backend *lib;
+    };
+
+    const struct hid_device_info *ptr = nullptr;
+    const Backend *lib = nullptr;
+    /// One enumeration per backend, freed by the backend that made it.
+    std::array<struct hid_device_info *, 2> lists{nullptr, nullptr};
+    std::array<const Backend *, 2> libs{nullptr, nullptr};
+    std::vector<Found> found;
+    Transport requested = Transport::transport_auto;
+  };
+
+  /// Time spent by a device in each kind of operation, in milliseconds.
+  struct LatencyStats {
+    Utils::Stats write;
+    /// From a request until its reply, as measured by the caller.
+    Utils::Stats round_trip;
   };
 
   class Device {
   public:
-    Device(const struct hid_device_info *device_info);
+    Device(const struct hid_device_info *device_info, const Backend *backend);
+    /// Opens a USB device with AsyncUsbDevice if transport_usb_async was requested.
     Device(const Enumerate &info);
-    Device(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number);
+    Device(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number,
+           const Backend *backend=HidApi::backend(Transport::transport_auto));
     Device(const Device &other) = delete;
     Device(Device &&other) noexcept;
 
@@ -137,9 +174,22 @@ namespace HidApi{
     std::string get_serial_number() const;
     std::string get_indexed(int string_index) const;
 
+    Transport transport() const noexcept;
+    const LatencyStats &stats() const noexcept;
+    void add_round_trip(double milliseconds);
+    /// nullptr unless it's opened with transport_usb_async.
+    const AsyncUsbStats *async_stats() const noexcept;
+
+    /// Sleeps until @param deadline. With transport_usb_async the reports
+    /// arriving meanwhile are queued, so none is missed between reads.
+    void wait_until(std::chrono::steady_clock::time_point deadline);
+
   private:
     hid_device *ptr = nullptr;
+    const Backend *lib = nullptr;
+    std::unique_ptr<AsyncUsbDevice> native;
     bool blocking = true;
+    LatencyStats latency;
   };
 
   void init();
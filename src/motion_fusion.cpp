@@ -0,0 +1,184 @@
+#include "motion_fusion.hpp"
+using namespace Motion;
+
+#include <cmath>
+
+namespace {
+  constexpr float counts_per_dps { 1.f / Constants::gyro_dps_per_count };
+
+  inline float inv_sqrt(float x) {
+    return 1.f / std::sqrt(x);
+  }
+
+  inline Vec4 scaled(const Vec4 &v, float k) {
+    Vec4 r;
+    for (size_t i = 0; i < 4; ++i) {
+      r[i] = v[i] * k;
+    }
+    return r;
+  }
+};
+
+
+Fusion::Fusion(float beta_gain): beta(beta_gain) {
+}
+
+void Fusion::update(const RealController::ImuSample &sample, float dt) {
+  alignas(16) Vec4 gyro_dps;
+  alignas(16) Vec4 accel_g;
+  for (size_t i = 0; i < 3; ++i) {
+    gyro_dps[i] = sample.gyro[i]  * Constants::gyro_dps_per_count;
+    accel_g[i]  = sample.accel[i] * Constants::accel_g_per_count;
+  }
+  gyro_dps[3] = accel_g[3] = 0.f;
+  update(gyro_dps, accel_g, dt);
+}
+
+void Fusion::update(const Vec4 &gyro_dps, const Vec4 &accel_g, float dt) {
+  update_bias(gyro_dps, accel_g);
+
+  alignas(16) Vec4 g;
+  for (size_t i = 0; i < 4; ++i) {
+    g[i] = (gyro_dps[i] - bias[i]) * Constants::deg_to_rad;
+  }
+
+  const float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+
+  /// Rate of change of quaternion from gyroscope.
+  alignas(16) Vec4 q_dot{
+    0.5f * (-q1 * g[0] - q2 * g[1] - q3 * g[2]),
+    0.5f * ( q0 * g[0] + q2 * g[2] - q3 * g[1]),
+    0.5f * ( q0 * g[1] - q1 * g[2] + q3 * g[0]),
+    0.5f * ( q0 * g[2] + q1 * g[1] - q2 * g[0]),
+  };
+
+  float a_norm = accel_g[0] * accel_g[0] + accel_g[1] * accel_g[1] + accel_g[2] * accel_g[2];
+  /// Free fall (or no data) gives no reference, so only the gyro is integrated.
+  if (a_norm > 0.f) {
+    const float inv = inv_sqrt(a_norm);
+    const float ax = accel_g[0] * inv, ay = accel_g[1] * inv, az = accel_g[2] * inv;
+
+    const float _2q0 = 2.f * q0, _2q1 = 2.f * q1, _2q2 = 2.f * q2, _2q3 = 2.f * q3;
+    const float _4q0 = 4.f * q0, _4q1 = 4.f * q1, _4q2 = 4.f * q2;
+    const float _8q1 = 8.f * q1, _8q2 = 8.f * q2;
+    const float q0q0 = q0 * q0, q1q1 = q1 * q1, q2q2 = q2 * q2, q3q3 = q3 * q3;
+
+    /// Gradient descent corrective step.
+    alignas(16) Vec4 s{
+      _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay,
+      _4q1 * q3q3 - _2q3 * ax + 4.f * q0q0 * q1 - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az,
+      4.f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az,
+      4.f * q1q1 * q3 - _2q1 * ax + 4.f * q2q2 * q3 - _2q2 * ay,
+    };
+    float s_norm = s[0] * s[0] + s[1] * s[1] + s[2] * s[2] + s[3] * s[3];
+    if (s_norm > 0.f) {
+      s = scaled(s, beta * inv_sqrt(s_norm));
+      for (size_t i = 0; i < 4; ++i) {
+        q_dot[i] -= s[i];
+      }
+    }
+  }
+
+  for (size_t i = 0; i < 4; ++i) {
+    q[i] += q_dot[i] * dt;
+  }
+  q = scaled(q, inv_sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]));
+}
+
+void Fusion::reset() {
+  q = {1.f, 0.f, 0.f, 0.f};
+  bias = {0.f, 0.f, 0.f, 0.f};
+  bias_counts = {0, 0, 0};
+  bias_seeded = false;
+  still_samples = 0;
+}
+
+const Vec4 &Fusion::quaternion() const {
+  return q;
+}
+
+Vec4 Fusion::gravity() const {
+  return Vec4{
+    2.f * (q[1] * q[3] - q[0] * q[2]),
+    2.f * (q[0] * q[1] + q[2] * q[3]),
+    q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3],
+    0.f,
+  };
+}
+
+std::array<float, 3> Fusion::yaw_pitch_roll() const {
+  const float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+  float sin_pitch = 2.f * (q0 * q2 - q3 * q1);
+  if (sin_pitch > 1.f) sin_pitch = 1.f;
+  if (sin_pitch < -1.f) sin_pitch = -1.f;
+
+  return {
+    std::atan2(2.f * (q0 * q3 + q1 * q2), 1.f - 2.f * (q2 * q2 + q3 * q3)) * Constants::rad_to_deg,
+    std::asin(sin_pitch) * Constants::rad_to_deg,
+    std::atan2(2.f * (q0 * q1 + q2 * q3), 1.f - 2.f * (q1 * q1 + q2 * q2)) * Constants::rad_to_deg,
+  };
+}
+
+const Vec4 &Fusion::gyro_bias() const {
+  return bias;
+}
+
+const std::array<int32_t, 3> &Fusion::gyro_bias_counts() const {
+  return bias_counts;
+}
+
+bool Fusion::is_still() const {
+  return still_samples >= Constants::still_samples_required;
+}
+
+void Fusion::update_bias(const Vec4 &gyro_dps, const Vec4 &accel_g) {
+  float a_norm = std::sqrt(accel_g[0] * accel_g[0] + accel_g[1] * accel_g[1] + accel_g[2] * accel_g[2]);
+  bool still = std::fabs(a_norm - 1.f) < Constants::still_accel_tolerance_g;
+  /// Gravity must also keep its direction, tilting moves it across the axes.
+  for (size_t i = 0; i < 3 && still && still_samples > 0; ++i) {
+    still = std::fabs(accel_g[i] - still_accel[i]) < Constants::still_accel_tolerance_g;
+  }
+  /// Once there's a bias, every sample is tested against it. Before, a steady
+  /// turn would look still against its own mean, so the window must also be
+  /// an offset a resting gyro can have.
+  for (size_t i = 0; i < 3 && still; ++i) {
+    if (bias_seeded) {
+      still = std::fabs(gyro_dps[i] - bias[i]) < Constants::still_gyro_tolerance_dps;
+    } else {
+      still = std::fabs(gyro_dps[i]) < Constants::max_seed_bias_dps &&
+              (still_samples == 0 || std::fabs(gyro_dps[i] - still_mean[i]) < Constants::still_gyro_tolerance_dps);
+    }
+  }
+
+  if (!still) {
+    still_samples = 0;
+    return;
+  }
+  if (still_samples == 0) {
+    still_accel = accel_g;
+  }
+  if (still_samples < Constants::still_samples_required) {
+    ++still_samples;
+    for (size_t i = 0; i < 3; ++i) {
+      still_mean[i] += (gyro_dps[i] - still_mean[i]) / still_samples;
+    }
+    /// The first still window is the whole estimate, later ones refine it.
+    if (still_samples == Constants::still_samples_required && !bias_seeded) {
+      bias = still_mean;
+      bias_seeded = true;
+      update_bias_counts();
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < 3; ++i) {
+    bias[i] += Constants::bias_learning_rate * (gyro_dps[i] - bias[i]);
+  }
+  update_bias_counts();
+}
+
+void Fusion::update_bias_counts() {
+  for (size_t i = 0; i < 3; ++i) {
+    bias_counts[i] = static_cast<int32_t>(std::lround(bias[i] * counts_per_dps));
+  }
+}
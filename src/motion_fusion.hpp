@@ -0,0 +1,84 @@
+#pragma once
+#ifndef PRO__MOTION_FUSION_HPP
+#define PRO__MOTION_FUSION_HPP
+
+#include <array>
+#include <cstdint>
+#include "real_controller_parser.hpp"
+
+namespace Motion {
+  namespace Constants {
+    /// Units of the calibrated samples. See RealController::ImuCalibration.
+    constexpr float accel_g_per_count   { 1.f / 4096.f };
+    constexpr float gyro_dps_per_count  { 936.f / 13371.f };
+
+    constexpr float deg_to_rad { 0.0174532925f };
+    constexpr float rad_to_deg { 57.2957795f };
+
+    /// Madgwick gain. Higher trusts the accelerometer more.
+    constexpr float default_beta { 0.1f };
+
+    /// Thresholds used to decide the controller is resting on something.
+    constexpr float still_accel_tolerance_g { 0.05f };
+    constexpr float still_gyro_tolerance_dps { 3.f };
+    /// Biggest offset the first bias estimate may have. More is a slow turn.
+    constexpr float max_seed_bias_dps { 10.f };
+    constexpr uint32_t still_samples_required { 40 }; // ~200 ms
+    constexpr float bias_learning_rate { 0.02f };
+  };
+
+  /// Four lanes so a vector is a single SSE/NEON register. Lane 3 is padding
+  /// for the 3D vectors.
+  using Vec4 = std::array<float, 4>;
+
+  /**
+   * @brief Madgwick IMU (gyro + accel) orientation filter, with an online gyro
+   * bias estimate learned while the controller is still.
+   */
+  class Fusion {
+  public:
+    Fusion(float beta = Constants::default_beta);
+
+    /// Feeds one calibrated sample. @param dt in seconds.
+    void update(const RealController::ImuSample &sample, float dt);
+
+    /**
+     * @param gyro_dps Angular rate in degrees per second.
+     * @param accel_g Acceleration in G.
+     * @param dt Seconds since the previous sample.
+     */
+    void update(const Vec4 &gyro_dps, const Vec4 &accel_g, float dt);
+
+    void reset();
+
+    /// Orientation quaternion as {w, x, y, z}.
+    const Vec4 &quaternion() const;
+    /// Unit gravity direction in the controller frame.
+    Vec4 gravity() const;
+    /// {yaw, pitch, roll} in degrees.
+    std::array<float, 3> yaw_pitch_roll() const;
+    /// Current gyro bias estimate, in degrees per second.
+    const Vec4 &gyro_bias() const;
+    /// Same estimate in raw gyro counts, refreshed only when the bias moves.
+    const std::array<int32_t, 3> &gyro_bias_counts() const;
+
+    bool is_still() const;
+
+  private:
+    void update_bias(const Vec4 &gyro_dps, const Vec4 &accel_g);
+    void update_bias_counts();
+
+    alignas(16) Vec4 q{1.f, 0.f, 0.f, 0.f};
+    alignas(16) Vec4 bias{0.f, 0.f, 0.f, 0.f};
+    std::array<int32_t, 3> bias_counts{0, 0, 0};
+
+    float beta;
+    uint32_t still_samples = 0;
+    /// Gyro mean and first accel sample of the current still window.
+    alignas(16) Vec4 still_mean{0.f, 0.f, 0.f, 0.f};
+    alignas(16) Vec4 still_accel{0.f, 0.f, 0.f, 0.f};
+    bool bias_seeded = false;
+  };
+};
+
+#endif
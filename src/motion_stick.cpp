@@ -0,0 +1,78 @@
+#include "motion_stick.hpp"
+using namespace Motion;
+
+#include <cmath>
+#include "motion_fusion.hpp"
+#include "utils.hpp"
+
+namespace {
+  constexpr int32_t stick_center{0x800};
+  constexpr int32_t stick_max{0xFFF};
+  constexpr int32_t accel_counts_per_g{4096};
+
+  /// Converts degrees (tilt) or degrees per second (gyro) to raw counts.
+  double to_counts(StickSource source, double value) {
+    if (source == StickSource::source_tilt) {
+      double clamped = Utils::Number::clamp<double>(value, -90.0, 90.0);
+      return std::sin(clamped * Constants::deg_to_rad) * accel_counts_per_g;
+    }
+    return value / Constants::gyro_dps_per_count;
+  }
+};
+
+
+StickMixer::StickMixer(const StickMixSettings &settings): source(settings.source),
+  x_axis(settings.x_axis), y_axis(settings.y_axis) {
+  deadzone_counts = static_cast<int32_t>(std::fabs(to_counts(source, settings.deadzone)));
+
+  double range_counts = to_counts(source, settings.range);
+  if (std::fabs(range_counts) <= deadzone_counts) {
+    throw std::domain_error("Motion stick range must be bigger than its deadzone.");
+  }
+  /// Full deflection right at the range, so the deadzone is subtracted.
+  double sign = range_counts < 0 ? -1.0 : 1.0;
+  double gain = sign * stick_center / (std::fabs(range_counts) - deadzone_counts);
+  gain_x_q8 = static_cast<int32_t>(std::lround(gain * 256));
+  /// Stick Y grows downwards, the sensors grow upwards.
+  gain_y_q8 = -gain_x_q8;
+
+  saturation = static_cast<int32_t>(Utils::Number::clamp<double>(settings.saturation, 0.0, 1.0) * stick_center);
+}
+
+void StickMixer::apply(const std::array<RealController::ImuSample, RealController::imu_samples_per_report> &samples,
+                       const std::array<int32_t, 3> &gyro_bias,
+                       std::array<uint16_t, 4> &axis_values) const {
+  int32_t x = 0, y = 0;
+  if (source == StickSource::source_gyro) {
+    /// Yaw and pitch rates, averaged over the report.
+    for (const RealController::ImuSample &imu: samples) {
+      x -= imu.gyro[2] - gyro_bias[2];
+      y += imu.gyro[1] - gyro_bias[1];
+    }
+    x /= static_cast<int32_t>(samples.size());
+    y /= static_cast<int32_t>(samples.size());
+  }
+  else {
+    /// Roll and pitch, from the gravity direction of the latest sample.
+    const RealController::ImuSample &imu = samples.back();
+    x = -imu.accel[1];
+    y =  imu.accel[0];
+  }
+
+  int32_t lx = axis_values[x_axis] + transform(x, gain_x_q8);
+  int32_t ly = axis_values[y_axis] + transform(y, gain_y_q8);
+  axis_values[x_axis] = Utils::Number::clamp<uint16_t>(lx, 0, stick_max);
+  axis_values[y_axis] = Utils::Number::clamp<uint16_t>(ly, 0, stick_max);
+}
+
+int32_t StickMixer::transform(int32_t value, int32_t gain_q8) const {
+  int32_t magnitude = value < 0 ? -value : value;
+  if (magnitude <= deadzone_counts) {
+    return 0;
+  }
+  /// Gains for small ranges reach tens of thousands in Q8, which overflows
+  /// 32 bits against a full scale gyro reading.
+  int64_t out = (static_cast<int64_t>(magnitude - deadzone_counts) * gain_q8) >> 8;
+  out = Utils::Number::clamp<int64_t>(out, -saturation, saturation);
+  return static_cast<int32_t>(value < 0 ? -out : out);
+}
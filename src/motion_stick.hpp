@@ -0,0 +1,60 @@
+#pragma once
+#ifndef PRO__MOTION_STICK_HPP
+#define PRO__MOTION_STICK_HPP
+
+#include <array>
+#include <cstdint>
+#include "real_controller_parser.hpp"
+
+namespace Motion {
+  enum StickSource {
+    source_gyro,  /// Angular rate drives the stick, like a mouse.
+    source_tilt,  /// Tilt angle drives the stick, like a steering wheel.
+  };
+
+  struct StickMixSettings {
+    StickSource source = StickSource::source_gyro;
+    RealController::Axis x_axis = RealController::Axis::axis_rx;
+    RealController::Axis y_axis = RealController::Axis::axis_ry;
+    /// Degrees per second (gyro) or degrees (tilt) that give full deflection.
+    /// Negative values invert the direction.
+    double range = 180.0;
+    /// Same units as range.
+    double deadzone = 2.0;
+    /// Max offset added to the stick, as a fraction of its half range.
+    double saturation = 1.0;
+  };
+
+  /**
+   * @brief Maps gyro rate or tilt onto a pair of stick axes and mixes it with
+   * the physical stick.
+   *
+   * Settings are converted to raw sensor counts and Q8 gains once, so the per
+   * report work is integer only.
+   */
+  class StickMixer {
+  public:
+    StickMixer(const StickMixSettings &settings);
+
+    /**
+     * @param samples Raw samples of the last report.
+     * @param gyro_bias Gyro bias, in raw counts.
+     * @param axis_values Mapped stick values, in [0, 0xFFF]. Updated in place.
+     */
+    void apply(const std::array<RealController::ImuSample, RealController::imu_samples_per_report> &samples,
+               const std::array<int32_t, 3> &gyro_bias,
+               std::array<uint16_t, 4> &axis_values) const;
+
+  private:
+    int32_t transform(int32_t value, int32_t gain_q8) const;
+
+    StickSource source;
+    RealController::Axis x_axis, y_axis;
+
+    int32_t deadzone_counts;
+    int32_t gain_x_q8, gain_y_q8;
+    int32_t saturation;
+  };
+};
+
+#endif
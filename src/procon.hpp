@@ -1,11 +1,15 @@
 #ifndef PROCON_DRIVER_H
 #define PROCON_DRIVER_H
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <cstring>
 #include <ctime>
+#include <exception>
 #include <fcntl.h>
 #include <fstream>
 #include <linux/input.h>
@@ -15,11 +19,22 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <filesystem>
+#include <future>
+#include <optional>
+#include <thread>
 
+#include "calibration_store.hpp"
 #include "config.hpp"
+#include "motion_fusion.hpp"
+#include "motion_stick.hpp"
 #include "real_controller.hpp"
 #include "real_controller_exceptions.hpp"
+#include "spsc_ring.hpp"
+#include "stick_recording.hpp"
+#include "sticks.hpp"
 #include "virtual_controller.hpp"
+#include "virtual_motion.hpp"
+#include "virtual_mouse.hpp"
 #include "utils.hpp"
 
 #define PROCON_DRIVER_VERSION "2.0"
@@ -33,13 +48,72 @@
 class ProController {
 public:
   ProController(unsigned short n_controller, const HidApi::Enumerate &device_info, 
-                Config &cfg): config(cfg), hid_ctrl(device_info, n_controller), uinput_ctrl() {
+                Config &cfg): config(cfg), hid_ctrl(device_info, n_controller, device_cache()),
+                uinput_ctrl(uinput_engine) {
     if (config.force_calibration) {
       read_calibration_from_file = false;
     }
+    if (config.motion_sensors) {
+      uinput_motion.emplace(uinput_engine);
+    }
+    if (config.gyro_mouse) {
+      uinput_mouse.emplace();
+      if (config.gyro_mouse_rate > 0) {
+        uinput_mouse->start_upsampling(config.gyro_mouse_rate);
+      }
+      gyro_mouse_ratchet = find_button(config.gyro_mouse_ratchet);
+    }
+    if (config.motion_stick) {
+      Motion::StickMixSettings settings;
+      settings.source = config.motion_stick_tilt ? Motion::StickSource::source_tilt : Motion::StickSource::source_gyro;
+      settings.x_axis = find_axis(config.motion_stick_x);
+      settings.y_axis = find_axis(config.motion_stick_y);
+      if (config.motion_stick_range != 0.0) {
+        settings.range = config.motion_stick_range;
+      } else if (config.motion_stick_tilt) {
+        settings.range = 30.0;
+      }
+      settings.deadzone = config.motion_stick_deadzone;
+      settings.saturation = config.motion_stick_saturation;
+      motion_stick.emplace(settings);
+    }
 
-    const char* home = getenv("HOME");
-    calibration_path = std::string(home) + calibration_path___;
+    calibration_path = config_directory();
+    calibration_store.emplace(calibration_path + store_filename);
+    stored_calibration = calibration_store->find(calibration_key());
+    if (!stored_calibration) {
+      stored_calibration = read_legacy_calibration();
+      if (stored_calibration) {
+        write_calibration(*calibration_store, calibration_path, *stored_calibration);
+      }
+    }
+    if (!hid_ctrl.has_imu_calibration() && stored_calibration && stored_calibration->has(Calibration::Record::has_imu)) {
+      hid_ctrl.set_imu_calibration(stored_calibration->imu);
+    }
+
+    rebuild_stick_tables();
+    stick_filters.fill(Sticks::OneEuroFilter(config.stick_filter_min_cutoff, config.stick_filter_beta));
+    uinput_ctrl.start_ff_service();
+    if (!config.record_path.empty()) {
+      stick_recorder.emplace(config.record_path);
+    }
+    if (config.output_rate > 0) {
+      std::optional<Sticks::PredictorSettings> prediction;
+      if (config.stick_prediction) {
+        prediction = config.prediction_settings();
+      }
+      uinput_ctrl.start_fixed_rate(config.output_rate, prediction);
+    } else if (config.stick_prediction) {
+      Utils::PrintColor::yellow(stderr, "Stick prediction needs a fixed output rate (--output-rate), ignoring it.\n");
+    }
+  }
+
+  ~ProController() {
+    try {
+      stop_pipeline();
+    }
+    catch (const std::exception &e) {
+    }
   }
 
   void print_sticks() const {
@@ -64,6 +138,92 @@ public:
     }
   }
 
+  void print_imu() const {
+    const RealController::ImuSample &imu = imu_samples[RealController::imu_samples_per_report - 1];
+    std::array<float, 3> ypr = fusion.yaw_pitch_roll();
+    printf("accel %6i %6i %6i gyro %6i %6i %6i ypr %7.2f %7.2f %7.2f%s",
+           imu.accel[0], imu.accel[1], imu.accel[2],
+           imu.gyro[0], imu.gyro[1], imu.gyro[2],
+           ypr[0], ypr[1], ypr[2], fusion.is_still() ? " still " : " ");
+  }
+
+  const Motion::Fusion &orientation() const {
+    return fusion;
+  }
+
+  void print_transport_stats() const {
+    const HidApi::Device &device = hid_ctrl.device();
+    const HidApi::LatencyStats &stats = device.stats();
+    Utils::PrintColor::cyan();
+    printf("Transport %s (%s): write %.3f ms average, %.3f ms max (%lu); "
+           "round trip %.2f ms average, %.2f ms max (%lu).\n",
+           HidApi::transport_name(device.transport()), hid_ctrl.bluetooth() ? "Bluetooth" : "USB",
+           stats.write.mean(), stats.write.max, (unsigned long)stats.write.count,
+           stats.round_trip.mean(), stats.round_trip.max, (unsigned long)stats.round_trip.count);
+    if (const HidApi::AsyncUsbStats *usb = device.async_stats()) {
+      printf("USB transfers: %lu reports, %lu overruns, %lu errors, %lu queued max.\n",
+             (unsigned long)usb->received, (unsigned long)usb->overruns,
+             (unsigned long)usb->errors, (unsigned long)usb->max_queued);
+    }
+    Utils::PrintColor::normal();
+  }
+
+  void print_tx_stats() const {
+    const RealController::TxStats &stats = hid_ctrl.tx_stats();
+    Utils::PrintColor::cyan();
+    printf("TX queue: %lu pending, %lu max.", (unsigned long)stats.depth, (unsigned long)stats.max_depth);
+    for (size_t i = 0; i < RealController::tx_classes; ++i) {
+      const RealController::TxClassStats &class_stats = stats.classes[i];
+      printf(" %s %lu sent, %lu merged, %lu dropped;",
+             RealController::tx_class_name(static_cast<RealController::TxClass>(i)),
+             (unsigned long)class_stats.sent, (unsigned long)class_stats.merged, (unsigned long)class_stats.dropped);
+    }
+    printf("\n");
+    Utils::PrintColor::normal();
+  }
+
+  void print_io_stats() const {
+    const VirtualController::IoStats &stats = uinput_engine.stats();
+    double per_frame = stats.frames > 0 ? stats.syscalls() / (double)stats.frames : 0.0;
+    Utils::PrintColor::cyan();
+    printf("uinput: %lu frames, %lu events; %lu writes, %lu reads; %.2f syscalls per frame.\n",
+           (unsigned long)stats.frames, (unsigned long)stats.events,
+           (unsigned long)stats.writes, (unsigned long)stats.reads, per_frame);
+    Utils::PrintColor::normal();
+  }
+
+  void print_ff_stats() {
+    VirtualController::FfStats stats = uinput_ctrl.ff_stats();
+    Utils::PrintColor::cyan();
+    printf("Force feedback: %lu requests answered in %.1f us average (%.1f us max).\n",
+           (unsigned long)stats.requests, stats.service_time.mean(), stats.service_time.max);
+    Utils::PrintColor::normal();
+  }
+
+  void print_output_stats() {
+    Utils::PrintColor::cyan();
+    if (config.output_rate > 0) {
+      VirtualController::OutputStats stats = uinput_ctrl.output_stats();
+      const Utils::IntervalStats &wakeups = stats.wakeups;
+      printf("Output at %u Hz: %lu ticks, %lu missed, %lu with changes (%lu extrapolated); "
+             "%.3f ms between ticks (%.3f ms max), %.3f ms jitter.\n",
+             config.output_rate, (unsigned long)stats.ticks, (unsigned long)stats.missed_ticks,
+             (unsigned long)stats.frames, (unsigned long)stats.predicted_frames,
+             wakeups.intervals.mean(), wakeups.intervals.max, wakeups.jitter());
+    } else {
+      printf("Output on each report: %.3f ms between frames (%.3f ms max), %.3f ms jitter.\n",
+             immediate_frames.intervals.mean(), immediate_frames.intervals.max, immediate_frames.jitter());
+    }
+    Utils::PrintColor::normal();
+  }
+
+  void print_filter_stats() const {
+    Utils::PrintColor::cyan();
+    printf("Stick filter added latency: %.2f ms average, %.2f ms max (%lu samples).\n",
+           filter_lag.mean() * 1000.0, filter_lag.max * 1000.0, (unsigned long)filter_lag.count);
+    Utils::PrintColor::normal();
+  }
+
   void print_calibration_values() const {
     for (const RealController::Axis &id: RealController::axis_ids) {
       printf("%s %03x,%03x,%03x   ", RealController::axis_name(id), axis_min[id], axis_cen[id], axis_max[id]);
@@ -73,10 +233,97 @@ public:
   void poll_input(long double delta_milis) {
     uinput_ctrl.update_time(delta_milis);
 
-    RealController::Parser parser = hid_ctrl.receive_input();
-    if (!parser.has_button_and_axis_data()) {
+    /// The controller sends a bit faster than the frames, so the reports that
+    /// queued up meanwhile are processed too instead of lagging behind.
+    std::optional<RealController::Parser> parser = hid_ctrl.receive_input();
+    do {
+      if (parser->has_button_and_axis_data()) {
+        process_input(*parser);
+      }
+      /// The calibration reads the rest itself.
+      if (!calibrated) {
+        break;
+      }
+      parser = hid_ctrl.receive_queued_input();
+    } while (parser);
+  }
+
+  /**
+   * @brief Starts the reader and writer threads, if they aren't running.
+   *
+   * The reader thread owns the controller: it reads the reports into a ring
+   * and sends the rumble queued by process_input. The uinput engine's writer
+   * thread owns the virtual devices and answers their force feedback
+   * requests instead of the force feedback service. The calling thread only
+   * processes the reports.
+   */
+  void start_pipeline() {
+    if (pipeline_running) {
+      return;
+    }
+    uinput_ctrl.stop_ff_service();
+    pipeline_running = true;
+    uinput_engine.start_writer([this](int) {
+      uinput_ctrl.update_state();
+    });
+    pipeline_reader = std::thread(&ProController::read_reports, this);
+  }
+
+  /// Joins the threads, so the controller can be used directly again (e.g. to calibrate).
+  void stop_pipeline() {
+    if (!pipeline_reader.joinable()) {
       return;
     }
+    pipeline_running = false;
+    pipeline_reader.join();
+    /// The writer thread answers force feedback until it's joined, and only
+    /// one thread may read the device.
+    uinput_engine.stop_writer();
+    uinput_ctrl.start_ff_service();
+    RumbleCommand dropped;
+    while (rumble_ring.try_pop(dropped)) {
+    }
+    if (reader_error) {
+      std::exception_ptr error = reader_error;
+      reader_error = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+  /// Processes every report queued by the reader thread, waiting for one if there's none.
+  void poll_pipeline(long double delta_milis) {
+    start_pipeline();
+    uinput_ctrl.update_time(delta_milis);
+
+    report_ready.wait(100);
+    std::optional<RealController::Parser> report;
+    while (report_ring.try_pop(report)) {
+      pipeline_stats.max_depth = std::max(pipeline_stats.max_depth, report_ring.size() + 1);
+      pipeline_stats.latency.add(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - report->timestamp()).count());
+      process_input(*report);
+      if (!calibrated) {
+        break;
+      }
+    }
+    if (!pipeline_running) {
+      stop_pipeline();
+    }
+  }
+
+  void print_pipeline_stats() const {
+    Utils::PrintColor::cyan();
+    printf("Pipeline: %lu reports, %lu dropped, %lu queued max, %.3f ms average queue time (%.3f ms max); "
+           "%lu rumble commands dropped, %lu uinput frames merged.\n",
+           (unsigned long)pipeline_stats.reports, (unsigned long)pipeline_stats.dropped_reports,
+           (unsigned long)pipeline_stats.max_depth, pipeline_stats.latency.mean(), pipeline_stats.latency.max,
+           (unsigned long)pipeline_stats.dropped_rumble, (unsigned long)uinput_engine.stats().merged_frames);
+    Utils::PrintColor::normal();
+  }
+
+  void process_input(const RealController::Parser &parser) {
+    if (!first_input_received) {
+      report_first_input(parser);
+    }
     update_input_state(parser);
 
     if (buttons_pressed[RealController::Buttons::home] &&
@@ -85,23 +332,82 @@ public:
       return;
     }
 
+    learn_range();
+    track_drift();
+    filter_sticks(parser.timestamp());
+
     manage_rumble();
 
+    mix_motion_stick();
+
+    uinput_ctrl.set_report_time(parser.timestamp());
     manage_buttons();
     manage_joysticks();
     manage_dpad();
+    if (stick_recorder) {
+      stick_recorder->add(parser.timestamp(), axis_values);
+    }
+    if (imu_updated) {
+      manage_motion();
+      manage_gyro_mouse();
+      imu_updated = false;
+    }
 
+    uinput_engine.flush();
+    if (config.output_rate == 0) {
+      immediate_frames.add(std::chrono::steady_clock::now());
+    }
     return;
   }
 
   void calibrate_from_file() {
     if (read_calibration_from_file) {
-      if (read_calibration_file()) {
+      if (apply_stored_calibration()) {
         calibrated = true;
+        rebuild_stick_tables();
+        reset_drift_tracking();
       }
     }
   }
 
+  /// Uses the calibration stored in the controller. Returns false if it
+  /// doesn't have a valid one.
+  bool calibrate_from_controller() {
+    const std::optional<RealController::StickCalibrationData> &data = hid_ctrl.stick_calibration();
+    if (!data) {
+      return false;
+    }
+    axis_min = data->min;
+    axis_cen = data->cen;
+    axis_max = data->max;
+    for (Sticks::PolarProfile &profile: polar_profiles) {
+      profile.clear();
+    }
+    calibrated = true;
+    rebuild_stick_tables();
+    reset_drift_tracking();
+    return true;
+  }
+
+  /// Starts with a default range and learns the real one while the controller
+  /// is used, so the input isn't blocked waiting for a calibration.
+  void calibrate_automatically() {
+    for (const RealController::Axis &id: RealController::axis_ids) {
+      range_learners[id].reset(center);
+      axis_cen[id] = center;
+      axis_min[id] = range_learners[id].min();
+      axis_max[id] = range_learners[id].max();
+    }
+    for (Sticks::PolarProfile &profile: polar_profiles) {
+      profile.clear();
+    }
+    calibrated = true;
+    learning_range = true;
+    range_center_learned = false;
+    rebuild_stick_tables();
+    reset_drift_tracking();
+  }
+
   void calibrate() {
     hid_ctrl.blink();
 
@@ -109,6 +415,9 @@ public:
     if (!parser.has_button_and_axis_data()) {
       return;
     }
+    if (!first_input_received) {
+      report_first_input(parser);
+    }
     update_input_state(parser);
 
     if (!share_button_free) {
@@ -120,6 +429,8 @@ public:
 
     if (perform_calibration(parser)) {
       calibrated = true;
+      rebuild_stick_tables();
+      reset_drift_tracking();
       write_calibration_to_file();
       hid_ctrl.led();
     }
@@ -132,9 +443,24 @@ public:
       axis_cen[id] = center;
     }
 
+    for (Sticks::PolarProfile &profile: polar_profiles) {
+      profile.clear();
+      profile.start_sampling();
+    }
+
     calibrated = false;
+    learning_range = false;
     read_calibration_from_file = false;
     share_button_free = false;
+    rebuild_stick_tables();
+  }
+
+  bool resumed_session() const {
+    return hid_ctrl.resumed_session();
+  }
+
+  void wait_until(std::chrono::steady_clock::time_point deadline) {
+    hid_ctrl.wait_until(deadline);
   }
 
   bool is_calibrated() const {
@@ -142,12 +468,8 @@ public:
   }
 
   bool needs_first_calibration() const {
-    return !read_calibration_from_file || !calibration_file_exists();
-  }
-
-  bool calibration_file_exists() const {
-    std::ifstream conf(calibration_path + calibration_filename);
-    return conf.good();
+    return !read_calibration_from_file || !stored_calibration
+           || !stored_calibration->has(Calibration::Record::has_sticks);
   }
 
 private:
@@ -157,6 +479,10 @@ private:
       if (value < axis_min[id]) axis_min[id] = value;
       if (value > axis_max[id]) axis_max[id] = value;
     }
+    if (config.polar_calibration) {
+      polar_profiles[0].sample(parser.get_axis_status(RealController::Axis::axis_lx), parser.get_axis_status(RealController::Axis::axis_ly));
+      polar_profiles[1].sample(parser.get_axis_status(RealController::Axis::axis_rx), parser.get_axis_status(RealController::Axis::axis_ry));
+    }
 
     if (!buttons_pressed[RealController::Buttons::share]) {
       return false;
@@ -165,62 +491,252 @@ private:
     for (const RealController::Axis &id: RealController::axis_ids) {
       axis_cen[id] = parser.get_axis_status(id);
     }
+    if (config.polar_calibration) {
+      /// Without enough directions, the stick falls back to the per axis calibration.
+      polar_profiles[0].finish(axis_cen[RealController::Axis::axis_lx], axis_cen[RealController::Axis::axis_ly]);
+      polar_profiles[1].finish(axis_cen[RealController::Axis::axis_rx], axis_cen[RealController::Axis::axis_ry]);
+    }
 
     return true;
   }
 
-  bool read_calibration_file() {
-    bool file_readed = false;
+  bool apply_stored_calibration() {
+    if (!stored_calibration || !stored_calibration->has(Calibration::Record::has_sticks)) {
+      return false;
+    }
+    const Calibration::Record &record = *stored_calibration;
+    axis_min = record.axis_min;
+    axis_max = record.axis_max;
+    axis_cen = record.axis_cen;
+
+    const std::array<uint32_t, 2> polar_flags{Calibration::Record::has_polar_left, Calibration::Record::has_polar_right};
+    for (size_t i = 0; i < polar_profiles.size(); ++i) {
+      polar_profiles[i].clear();
+      if (record.has(polar_flags[i])) {
+        polar_profiles[i].set(record.polar_center[i][0], record.polar_center[i][1], record.polar_radii[i]);
+      }
+    }
+    return true;
+  }
+
+  std::string calibration_key() const {
+    const std::string &identity = hid_ctrl.identity();
+    return identity.empty() ? "default" : identity;
+  }
+
+  /// Reads the files used before the store, shared by every controller.
+  std::optional<Calibration::Record> read_legacy_calibration() const {
     std::ifstream myReadFile;
-    myReadFile.open(calibration_path + calibration_filename,
+    myReadFile.open(calibration_path + legacy_calibration_filename,
                     std::ios::in | std::ios::binary);
-    if (myReadFile) {
-      for (const RealController::Axis &id: RealController::axis_ids) {
-        myReadFile.read((char *)&axis_min[id], sizeof(uint16_t));
-        myReadFile.read((char *)&axis_max[id], sizeof(uint16_t));
-        myReadFile.read((char *)&axis_cen[id], sizeof(uint16_t));
+    if (!myReadFile) {
+      return std::nullopt;
+    }
+    Calibration::Record record = Calibration::Record::make(calibration_key());
+    for (const RealController::Axis &id: RealController::axis_ids) {
+      myReadFile.read((char *)&record.axis_min[id], sizeof(uint16_t));
+      myReadFile.read((char *)&record.axis_max[id], sizeof(uint16_t));
+      myReadFile.read((char *)&record.axis_cen[id], sizeof(uint16_t));
+    }
+    if (!myReadFile) {
+      return std::nullopt;
+    }
+    record.flags |= Calibration::Record::has_sticks;
+
+    std::ifstream polar_file(calibration_path + legacy_polar_filename, std::ios::in | std::ios::binary);
+    const std::array<uint32_t, 2> polar_flags{Calibration::Record::has_polar_left, Calibration::Record::has_polar_right};
+    for (size_t i = 0; i < polar_profiles.size() && polar_file; ++i) {
+      polar_file.read((char *)record.polar_center[i].data(), sizeof(uint16_t) * 2);
+      polar_file.read((char *)record.polar_radii[i].data(), sizeof(uint16_t) * Sticks::PolarProfile::bins);
+      Sticks::PolarProfile profile;
+      profile.set(record.polar_center[i][0], record.polar_center[i][1], record.polar_radii[i]);
+      if (polar_file && profile.is_valid()) {
+        record.flags |= polar_flags[i];
+      }
+    }
+    return record;
+  }
+
+  Calibration::Record calibration_record() const {
+    Calibration::Record record = Calibration::Record::make(calibration_key());
+    record.flags = Calibration::Record::has_sticks;
+    record.axis_min = axis_min;
+    record.axis_max = axis_max;
+    for (const RealController::Axis &id: RealController::axis_ids) {
+      record.axis_cen[id] = current_center(id);
+    }
+
+    const std::array<RealController::Axis, 2> x_axis{RealController::Axis::axis_lx, RealController::Axis::axis_rx};
+    const std::array<RealController::Axis, 2> y_axis{RealController::Axis::axis_ly, RealController::Axis::axis_ry};
+    const std::array<uint32_t, 2> polar_flags{Calibration::Record::has_polar_left, Calibration::Record::has_polar_right};
+    for (size_t i = 0; i < polar_profiles.size(); ++i) {
+      if (polar_profiles[i].is_valid()) {
+        record.flags |= polar_flags[i];
+        record.polar_center[i] = {current_center(x_axis[i]), current_center(y_axis[i])};
+        record.polar_radii[i] = polar_profiles[i].radii();
       }
-      file_readed = true;
     }
 
-    myReadFile.close();
-    return file_readed;
+    if (hid_ctrl.has_imu_calibration()) {
+      record.flags |= Calibration::Record::has_imu;
+      record.imu = hid_ctrl.imu_calibration().data();
+    }
+    return record;
   }
 
   void write_calibration_to_file() {
-    std::filesystem::create_directories(calibration_path);
-    std::ofstream calibration_file;
-    calibration_file.open(calibration_path + calibration_filename,
-                          std::ios::out | std::ios::binary);
-    for (const RealController::Axis &id: RealController::axis_ids) {
-      calibration_file.write((char *)&axis_min[id], sizeof(uint16_t));
-      calibration_file.write((char *)&axis_max[id], sizeof(uint16_t));
-      calibration_file.write((char *)&axis_cen[id], sizeof(uint16_t));
+    if (pending_write.valid()) {
+      pending_write.wait();
+    }
+    stored_calibration = calibration_record();
+    write_calibration(*calibration_store, calibration_path, *stored_calibration);
+  }
+
+  /// Writes from another thread, so the input isn't blocked by the disk.
+  /// Skipped if the previous write hasn't finished, a later one will catch up.
+  void write_calibration_in_background() {
+    if (pending_write.valid() && pending_write.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      return;
+    }
+    stored_calibration = calibration_record();
+    pending_write = std::async(std::launch::async, write_calibration, std::ref(*calibration_store),
+                               calibration_path, *stored_calibration);
+  }
+
+  static void write_calibration(Calibration::Store &store, const std::string &path, const Calibration::Record &record) {
+    try {
+      std::filesystem::create_directories(path);
+      store.put(record);
+    }
+    catch (const std::system_error &e) {
+      Utils::PrintColor::red(stderr);
+      fprintf(stderr, "Couldn't save the calibration: %s\n", e.what());
+      Utils::PrintColor::normal(stderr);
     }
-    calibration_file.close();
   }
 
 
   void manage_rumble() {
     for(const auto &effect: uinput_ctrl.getRumbleEffects()) {
-      if (effect->get_remaining() > 0) {
-        auto data = effect->get_data();
+      if (effect.get_remaining() > 0) {
+        auto data = effect.get_data();
         if (data.strong) {
-          hid_ctrl.rumble(320, 160, data.strong/(double)0x10000);
+          rumble(320, 160, data.strong/(double)0x10000);
         }
         else if(data.weak) {
-          hid_ctrl.rumble(120, 80, data.weak/(double)0x10000);
+          rumble(120, 80, data.weak/(double)0x10000);
         }
       }
     }
+  }
 
-    uinput_ctrl.update_state();
+  void rumble(double high_freq, double low_freq, double amplitude) {
+    if (!pipeline_running) {
+      hid_ctrl.rumble(high_freq, low_freq, amplitude);
+      return;
+    }
+    RealController::Rumble::RumbleArray data = RealController::Rumble::rumble(high_freq, low_freq, amplitude);
+    if (!rumble_ring.try_push({data, data})) {
+      ++pipeline_stats.dropped_rumble;
+    }
+  }
+
+  /// Reader thread of the pipeline.
+  void read_reports() {
+    try {
+      while (pipeline_running) {
+        RumbleCommand command;
+        while (rumble_ring.try_pop(command)) {
+          hid_ctrl.rumble(command[0], command[1]);
+        }
+
+        RealController::Parser parser = hid_ctrl.receive_input();
+        if (!parser.has_button_and_axis_data()) {
+          continue;
+        }
+        ++pipeline_stats.reports;
+        if (report_ring.try_push(parser)) {
+          report_ready.notify();
+        } else {
+          ++pipeline_stats.dropped_reports;
+        }
+      }
+    }
+    catch (...) {
+      reader_error = std::current_exception();
+      pipeline_running = false;
+      report_ready.notify();
+    }
   }
 
   //-------------------------
   //         UINPUT
   //-------------------------
 
+  void manage_motion() {
+    if (!uinput_motion) {
+      return;
+    }
+
+    for (size_t i = 0; i < RealController::imu_samples_per_report; ++i) {
+      imu_timestamp_us += imu_sample_period_us;
+      uinput_motion->send_sample(imu_samples[i].accel, imu_samples[i].gyro, static_cast<uint32_t>(imu_timestamp_us));
+    }
+  }
+
+  void filter_sticks(std::chrono::steady_clock::time_point report_time) {
+    if (!config.stick_filter) {
+      return;
+    }
+    double dt = std::chrono::duration<double>(report_time - filter_last_report).count();
+    filter_last_report = report_time;
+
+    for (const RealController::Axis &id: RealController::axis_ids) {
+      double value = stick_filters[id].filter(axis_values[id], dt);
+      axis_values[id] = Utils::Number::clamp<uint16_t>(std::lround(value), 0x000, 0xFFF);
+      filter_lag.add(stick_filters[id].last_lag());
+    }
+  }
+
+  void mix_motion_stick() {
+    /// Reports without motion data would otherwise replay the last samples.
+    if (!motion_stick || !imu_updated) {
+      return;
+    }
+    motion_stick->apply(imu_samples, fusion.gyro_bias_counts(), axis_values);
+  }
+
+  void manage_gyro_mouse() {
+    if (!uinput_mouse) {
+      return;
+    }
+    if (gyro_mouse_ratchet != RealController::Buttons::None && buttons_pressed[gyro_mouse_ratchet]) {
+      return;
+    }
+
+    const Motion::Vec4 &bias = fusion.gyro_bias();
+    const float dt = imu_sample_period_us / 1000000.f;
+    float dx = 0.f, dy = 0.f;
+    for (const RealController::ImuSample &imu: imu_samples) {
+      float yaw   = imu.gyro[2] * Motion::Constants::gyro_dps_per_count - bias[2];
+      float pitch = imu.gyro[1] * Motion::Constants::gyro_dps_per_count - bias[1];
+      float sensitivity = gyro_mouse_sensitivity(std::sqrt(yaw * yaw + pitch * pitch));
+      dx -= yaw   * sensitivity * dt;
+      dy -= pitch * sensitivity * dt;
+    }
+    uinput_mouse->move(dx, dy, imu_sample_period_us * RealController::imu_samples_per_report);
+  }
+
+  /// Linear ramp from the base sensitivity to the max one, reached at
+  /// `gyro_mouse_accel_speed`.
+  float gyro_mouse_sensitivity(float speed_dps) const {
+    if (config.gyro_mouse_accel_speed <= 0) {
+      return config.gyro_mouse_sensitivity;
+    }
+    float t = Utils::Number::clamp<float>(speed_dps / config.gyro_mouse_accel_speed, 0.f, 1.f);
+    return config.gyro_mouse_sensitivity + (config.gyro_mouse_max_sensitivity - config.gyro_mouse_sensitivity) * t;
+  }
+
   void manage_dpad() {
     int x = 0, y = 0;
     if (dpad_pressed[RealController::Dpad::d_left]) {
@@ -294,11 +810,19 @@ private:
       axis_values[RealController::Axis::axis_ry] = Utils::Number::clamp<uint16_t>(axis_values[RealController::Axis::axis_ry] + config.dribble_cam_value - 0x7FF, 0x000, 0xFFF);
     }
 
+    /// Unchanged axis would be dropped by the kernel anyway.
+    bool changed = false;
     for (const RealController::Axis &id: RealController::axis_ids) {
-      uinput_ctrl.write_single_joystick(axis_values[id], axis_map[id]);
+      if (axis_values[id] != axis_sent[id]) {
+        uinput_ctrl.write_single_joystick(axis_values[id], axis_map[id]);
+        axis_sent[id] = axis_values[id];
+        changed = true;
+      }
     }
 
-    uinput_ctrl.send_report();
+    if (changed) {
+      uinput_ctrl.send_report();
+    }
   }
 
   void update_input_state(const RealController::Parser &parser) {
@@ -312,7 +836,7 @@ private:
 
     /// Axis
     for (const RealController::Axis &id: RealController::axis_ids) {
-      axis_values[id] = parser.get_axis_status(id);
+      axis_raw[id] = axis_values[id] = parser.get_axis_status(id);
     }
 
     /// dpad
@@ -341,32 +865,206 @@ private:
       dpad_pressed[RealController::Dpad::d_down]  = parser.is_dpad_pressed(RealController::Dpad::d_up);
     }
 
-    if (calibrated) {
-      map_sticks();
+    /// IMU
+    if (parser.has_imu_data()) {
+      update_imu_state(parser);
+    }
+
+    map_sticks();
+  }
+
+  void update_imu_state(const RealController::Parser &parser) {
+    /// The report carries the samples taken since the previous one, so they
+    /// are spread evenly across that interval, oldest first.
+    int64_t interval_us = imu_report_interval_us;
+    if (imu_last_report.time_since_epoch().count() != 0) {
+      interval_us = std::chrono::duration_cast<std::chrono::microseconds>(parser.timestamp() - imu_last_report).count();
+      interval_us = Utils::Number::clamp<int64_t>(interval_us, 0, 2 * imu_report_interval_us);
     }
+    imu_last_report = parser.timestamp();
+    imu_sample_period_us = interval_us / RealController::imu_samples_per_report;
 
-    // Invert axis
-    if (config.invert_lx) axis_values[RealController::Axis::axis_lx] = 0xFFF - axis_values[RealController::Axis::axis_lx];
-    if (config.invert_ly) axis_values[RealController::Axis::axis_ly] = 0xFFF - axis_values[RealController::Axis::axis_ly];
-    if (config.invert_rx) axis_values[RealController::Axis::axis_rx] = 0xFFF - axis_values[RealController::Axis::axis_rx];
-    if (config.invert_ry) axis_values[RealController::Axis::axis_ry] = 0xFFF - axis_values[RealController::Axis::axis_ry];
+    for (size_t i = 0; i < RealController::imu_samples_per_report; ++i) {
+      imu_samples[i] = parser.get_imu_sample(i);
+      fusion.update(imu_samples[i], imu_sample_period_us / 1000000.f);
+    }
+    imu_updated = true;
   }
 
+  /// Calibration and inversion are folded into the tables.
   void map_sticks() {
+    /// Brings the drifted center back to the calibrated one.
     for (const RealController::Axis &id: RealController::axis_ids) {
-      long double val;
-      if (axis_values[id] < axis_cen[id]) {
-        val = (long double)(axis_values[id] - axis_min[id]) /
-              (long double)(axis_cen[id] - axis_min[id]) / 2.L;
-      } else {
-        val = (long double)(axis_values[id] - axis_cen[id]) /
-              (long double)(axis_max[id] - axis_cen[id]) / 2.L;
-        val += 0.5L;
+      if (drift_offset[id] != 0) {
+        axis_values[id] = Utils::Number::clamp<uint16_t>(axis_values[id] + drift_offset[id], 0x000, 0xFFF);
       }
-      axis_values[id] = Utils::Number::clamp<uint16_t>(val * 0xFFF, 0x000, 0xFFF);
+    }
+    /// Polar profiles replace the per axis calibration, the tables then only invert.
+    if (calibrated && polar_profiles[0].is_valid()) {
+      polar_profiles[0].apply(axis_values[RealController::Axis::axis_lx], axis_values[RealController::Axis::axis_ly]);
+    }
+    if (calibrated && polar_profiles[1].is_valid()) {
+      polar_profiles[1].apply(axis_values[RealController::Axis::axis_rx], axis_values[RealController::Axis::axis_ry]);
+    }
+    for (const RealController::Axis &id: RealController::axis_ids) {
+      axis_values[id] = axis_lut[id][axis_values[id]];
+    }
+    if (calibrated) {
+      stick_shapers[0].apply(axis_values[RealController::Axis::axis_lx], axis_values[RealController::Axis::axis_ly]);
+      stick_shapers[1].apply(axis_values[RealController::Axis::axis_rx], axis_values[RealController::Axis::axis_ry]);
     }
   }
 
+  /// Prints how long it took from opening the controller to its first input.
+  void report_first_input(const RealController::Parser &parser) {
+    first_input_received = true;
+    auto to_ms = [](std::chrono::steady_clock::duration d) {
+      return std::chrono::duration<double, std::milli>(d).count();
+    };
+
+    Utils::PrintColor::cyan();
+    printf("Time to first input: %.1f ms (", to_ms(parser.timestamp() - hid_ctrl.attach_time()));
+    const char *separator = "";
+    for (size_t i = 0; i < RealController::InitStep::init_done; ++i) {
+      RealController::InitStep step = static_cast<RealController::InitStep>(i);
+      if (hid_ctrl.init_time(step).count() > 0) {
+        printf("%s%s %.1f", separator, RealController::init_step_name(step), to_ms(hid_ctrl.init_time(step)));
+        separator = ", ";
+      }
+    }
+    printf(").\n");
+    Utils::PrintColor::normal();
+  }
+
+  void learn_range() {
+    if (!learning_range) {
+      return;
+    }
+
+    /// The sticks are usually resting when the controller connects, so the
+    /// first report is a better center than the nominal one.
+    if (!range_center_learned) {
+      range_center_learned = true;
+      for (const RealController::Axis &id: RealController::axis_ids) {
+        if (std::abs(axis_raw[id] - center) < max_initial_offset) {
+          axis_cen[id] = axis_raw[id];
+          range_learners[id].reset(axis_raw[id]);
+        }
+      }
+      reset_drift_tracking();
+      rebuild_stick_tables();
+    }
+
+    for (const RealController::Axis &id: RealController::axis_ids) {
+      if (range_learners[id].update(axis_raw[id])) {
+        axis_min[id] = range_learners[id].min();
+        axis_max[id] = range_learners[id].max();
+        range_stale[id] = true;
+      }
+    }
+    /// A stick swept to its edge grows the range on every report, so the
+    /// tables of the axes that changed are rebuilt at a limited rate.
+    auto now = std::chrono::steady_clock::now();
+    if (now - range_last_rebuild < range_rebuild_interval) {
+      return;
+    }
+    for (const RealController::Axis &id: RealController::axis_ids) {
+      if (range_stale[id]) {
+        range_stale[id] = false;
+        range_last_rebuild = now;
+        rebuild_axis_table(id);
+      }
+    }
+  }
+
+  void track_drift() {
+    if (!config.track_drift || !calibrated) {
+      return;
+    }
+    bool idle = std::none_of(buttons_pressed.begin(), buttons_pressed.end(), [](bool b) { return b; })
+                && std::none_of(dpad_pressed.begin(), dpad_pressed.end(), [](bool b) { return b; });
+    /// Moving one axis stops every one of them from following the drift.
+    for (const RealController::Axis &id: RealController::axis_ids) {
+      idle = drift_estimators[id].observe(axis_raw[id]) && idle;
+    }
+
+    for (const RealController::Axis &id: RealController::axis_ids) {
+      if (drift_estimators[id].settle(idle)) {
+        /// Applied before the tables, so they don't need rebuilding.
+        drift_offset[id] = -drift_estimators[id].drift();
+        drift_unsaved = true;
+      }
+      if (drift_estimators[id].drifted() && !drift_warned[id]) {
+        drift_warned[id] = true;
+        Utils::PrintColor::yellow();
+        printf("\n%s drifted %i counts from its calibrated center, the most that is followed. "
+               "Recalibrating is recommended.\n", RealController::axis_name(id), drift_estimators[id].drift());
+        Utils::PrintColor::normal();
+      }
+    }
+    if (drift_unsaved && std::chrono::steady_clock::now() - drift_last_save >= drift_save_interval) {
+      drift_last_save = std::chrono::steady_clock::now();
+      drift_unsaved = false;
+      write_calibration_in_background();
+    }
+  }
+
+  /// Calibrated center, plus the drift followed since.
+  uint16_t current_center(RealController::Axis id) const {
+    return axis_cen[id] - drift_offset[id];
+  }
+
+  /// Must be called every time the calibration changes.
+  void rebuild_stick_tables() {
+    for (const RealController::Axis &id: RealController::axis_ids) {
+      rebuild_axis_table(id);
+    }
+    for (size_t i = 0; i < stick_shapers.size(); ++i) {
+      stick_shapers[i].build(config.stick_profiles[i]);
+    }
+  }
+
+  /// Only the table of @param id, the shapers don't depend on the calibration.
+  void rebuild_axis_table(RealController::Axis id) {
+    const std::array<bool, 4> invert{config.invert_lx, config.invert_ly, config.invert_rx, config.invert_ry};
+    bool polar = polar_profiles[id < RealController::Axis::axis_rx ? 0 : 1].is_valid();
+    if (calibrated && !polar) {
+      axis_lut[id].build(axis_min[id], axis_cen[id], axis_max[id], invert[id]);
+    } else {
+      axis_lut[id].build_identity(invert[id]);
+    }
+  }
+
+  /// Starts tracking the drift from the current calibration.
+  void reset_drift_tracking() {
+    for (const RealController::Axis &id: RealController::axis_ids) {
+      drift_estimators[id].reset(axis_cen[id]);
+      drift_warned[id] = false;
+      drift_offset[id] = 0;
+    }
+  }
+
+  RealController::Buttons find_button(const std::string &name) const {
+    if (name.empty()) {
+      return RealController::Buttons::None;
+    }
+    for (const RealController::Buttons &id: RealController::btns_ids) {
+      if (name == RealController::button_name(id)) {
+        return id;
+      }
+    }
+    throw std::invalid_argument("Unknown button " + name + ".");
+  }
+
+  RealController::Axis find_axis(const std::string &name) const {
+    for (const RealController::Axis &id: RealController::axis_ids) {
+      if ("axis_" + name == RealController::axis_name(id)) {
+        return id;
+      }
+    }
+    throw std::invalid_argument("Unknown axis " + name + ".");
+  }
+
   void toggle_dribble_mode() {
     dribble_mode = !dribble_mode; 
   }
@@ -413,8 +1111,28 @@ private:
   }
 
   std::string calibration_path;
-  const std::string calibration_path___ = "/.config/procon_driver/";
-  const std::string calibration_filename = "procon_calibration_data.bin";
+  static std::string config_directory() {
+    const char* home = getenv("HOME");
+    return std::string(home) + "/.config/procon_driver/";
+  }
+
+  /// Shared by every controller, opened on the first attach.
+  static RealController::DeviceCache *device_cache() {
+    static RealController::DeviceCache cache(config_directory() + device_cache_filename);
+    std::error_code error;
+    std::filesystem::create_directories(config_directory(), error);
+    return &cache;
+  }
+  static constexpr const char *device_cache_filename = "device_cache.bin";
+  static constexpr const char *store_filename = "calibration_store.bin";
+  /// Only read, to migrate the calibration to the store.
+  static constexpr const char *legacy_calibration_filename = "procon_calibration_data.bin";
+  static constexpr const char *legacy_polar_filename = "procon_polar_calibration.bin";
+  std::optional<Calibration::Store> calibration_store;
+  /// Looked up once when the controller is attached.
+  std::optional<Calibration::Record> stored_calibration;
+  /// Declared after the store, so it's destroyed first.
+  std::future<void> pending_write;
 
   bool calibrated = false;
   bool read_calibration_from_file =
@@ -428,6 +1146,35 @@ private:
 
   std::array<int, 4> axis_map = make_axis_map();
   std::array<uint16_t, 4> axis_values{center};
+  std::array<Sticks::AxisLut, 4> axis_lut;
+  std::array<Sticks::StickShaper, 2> stick_shapers;
+  std::array<Sticks::PolarProfile, 2> polar_profiles;
+  std::array<uint16_t, 4> axis_raw{center};
+  std::array<Sticks::DriftEstimator, 4> drift_estimators;
+  /// Added to the raw values, from the estimated center to the calibrated one.
+  std::array<int32_t, 4> drift_offset{};
+  std::array<Sticks::RangeLearner, 4> range_learners;
+  bool learning_range = false;
+  bool first_input_received = false;
+  bool range_center_learned = false;
+  /// Farther than this from the nominal center, the stick is probably held.
+  static constexpr int max_initial_offset{0x200};
+  static constexpr std::chrono::milliseconds range_rebuild_interval{100};
+  std::chrono::steady_clock::time_point range_last_rebuild;
+  std::array<bool, 4> range_stale{false};
+  std::array<bool, 4> drift_warned{false};
+  /// The centers move a little at a time, no need to save every step.
+  static constexpr std::chrono::seconds drift_save_interval{30};
+  std::chrono::steady_clock::time_point drift_last_save;
+  bool drift_unsaved = false;
+  std::array<Sticks::OneEuroFilter, 4> stick_filters;
+  std::chrono::steady_clock::time_point filter_last_report;
+  Utils::Stats filter_lag;
+  /// Without a fixed output rate.
+  Utils::IntervalStats immediate_frames;
+  std::optional<Sticks::Recorder> stick_recorder;
+  /// Last values written to uinput. Out of range so the first report is sent.
+  std::array<uint16_t, 4> axis_sent{0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF};
 
   std::array<int, 14> btns_map = make_button_map();
   const std::array<RealController::Buttons, 12> xbox_btns_ids{
@@ -445,11 +1192,47 @@ private:
   std::array<bool, 4> dpad_pressed{false};
   std::array<bool, 4> dpad_last{false};
 
+  std::array<RealController::ImuSample, RealController::imu_samples_per_report> imu_samples{};
+  bool imu_updated = false;
+  /// 3 samples, ~5 ms apart.
+  static constexpr int64_t imu_report_interval_us{15000};
+  std::chrono::steady_clock::time_point imu_last_report;
+  int64_t imu_sample_period_us = imu_report_interval_us / RealController::imu_samples_per_report;
+  uint64_t imu_timestamp_us = 0;
+  Motion::Fusion fusion;
+
+  RealController::Buttons gyro_mouse_ratchet = RealController::Buttons::None;
+  std::optional<Motion::StickMixer> motion_stick;
+
   bool dribble_mode = false;
 
+  using RumbleCommand = std::array<RealController::Rumble::RumbleArray, 2>;
+  struct PipelineStats {
+    /// Written by the reader thread.
+    uint64_t reports = 0;
+    uint64_t dropped_reports = 0;
+    /// Written by the processing thread.
+    uint64_t dropped_rumble = 0;
+    size_t max_depth = 0;
+    /// From reading a report until processing it, in milliseconds.
+    Utils::Stats latency;
+  };
+
+  std::atomic<bool> pipeline_running{false};
+  std::thread pipeline_reader;
+  std::exception_ptr reader_error;
+  Utils::SpscRing<std::optional<RealController::Parser>, 32> report_ring;
+  Utils::Notifier report_ready;
+  Utils::SpscRing<RumbleCommand, 16> rumble_ring;
+  PipelineStats pipeline_stats;
+
   Config &config;
   RealController::Controller hid_ctrl;
+  /// Declared before the devices that queue on it, so it outlives them.
+  VirtualController::UinputEngine uinput_engine;
   VirtualController::Controller uinput_ctrl;
+  std::optional<VirtualController::MotionSensors> uinput_motion;
+  std::optional<VirtualController::Mouse> uinput_mouse;
 };
 
 #endif
@@ -1,37 +1,45 @@
 #include "real_controller.hpp"
 using namespace RealController;
 
+#include <algorithm>
 #include "real_controller_rumble.hpp"
 
 extern bool controller_loop;
 
-Controller::Controller(const HidApi::Enumerate &device_info, unsigned short n_controll)
-              : connection(device_info), n_controller(n_controll) {
-  closed = false;
-  connection.setBlocking();
-
-  if (!connection.Bluetooth()) {
-    /*RealController::ControllerMAC mac = */connection.request_mac();
-    //printf("controller_type: %02x\n", mac.controller_type);
-    //printf("mac: %02x", mac.mac[0]);
-    //for (size_t i = 1; i < 6; ++i) {
-      //printf(":%02x", mac.mac[i]);
-    //}
-    //printf("\n");
-
-    connection.do_handshake();
-    connection.increment_baudrate();
-    connection.do_handshake();
+static std::string mac_to_string(const std::array<uint8_t, 6> &mac) {
+  char mac_str[18];
+  snprintf(mac_str, sizeof(mac_str), "%02x:%02x:%02x:%02x:%02x:%02x",
+           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  return mac_str;
+}
 
-    connection.enable_hid_only_mode();
+const char *RealController::init_step_name(InitStep step) {
+  switch (step) {
+  case InitStep::init_probe:          return "probe";
+  case InitStep::init_device_info:    return "device_info";
+  case InitStep::init_request_mac:    return "request_mac";
+  case InitStep::init_handshake:      return "handshake";
+  case InitStep::init_baudrate:       return "baudrate";
+  case InitStep::init_handshake_fast: return "handshake_fast";
+  case InitStep::init_hid_only:       return "hid_only";
+  case InitStep::init_rumble:         return "rumble";
+  case InitStep::init_imu:            return "imu";
+  case InitStep::init_metadata:       return "metadata";
+  case InitStep::init_report_mode:    return "report_mode";
+  case InitStep::init_done:           return "done";
   }
+  return "unknown";
+}
 
-  connection.toggle_rumble(true);
-  connection.toggle_imu(true);
 
-  // connection.set_imu_sensitivity(0x03, 0x00, 0x00, 0x01);
+Controller::Controller(const HidApi::Enumerate &device_info, unsigned short n_controll,
+                       RealController::DeviceCache *cache)
+              : connection(device_info), n_controller(n_controll),
+                attach_start(std::chrono::steady_clock::now()) {
+  closed = false;
+  connection.setBlocking();
 
-  connection.set_input_report_mode(0x30);
+  initialize(cache);
 
   #if 0
   if (connection.Bluetooth()) {
@@ -45,13 +53,130 @@ Controller::Controller(const HidApi::Enumerate &device_info, unsigned short n_co
   connection.setNonBlocking();
   // usleep(100 * 1000);
 
+  tx.set_interval(connection.Bluetooth() ? TxScheduler::bluetooth_interval : TxScheduler::usb_interval);
+
   led();
 }
 
+void Controller::initialize(RealController::DeviceCache *cache) {
+  InitStep step = connection.Bluetooth() ? InitStep::init_rumble : InitStep::init_probe;
+  while (step != InitStep::init_done) {
+    auto step_start = std::chrono::steady_clock::now();
+    InitStep next = InitStep::init_done;
+    bool done = false;
+    for (size_t attempt = 0; attempt < init_retries && !done; ++attempt) {
+      done = run_init_step(step, cache, next);
+    }
+    if (!done) {
+      throw InitError("InitError: No reply to the '" + std::string(init_step_name(step)) + "' step.");
+    }
+    init_times[step] = std::chrono::steady_clock::now() - step_start;
+    step = next;
+  }
+  init_report.reset();
+}
+
+bool Controller::run_init_step(InitStep step, RealController::DeviceCache *cache, InitStep &next) {
+  switch (step) {
+  case InitStep::init_probe:
+    /// The MAC isn't known yet, so any controller left streaming is enough
+    /// to spend the wait. Otherwise the UART handshake starts right away.
+    if (cache != nullptr && cache->any_of([](const RealController::DeviceMetadata &entry) { return entry.input_mode != 0; })) {
+      init_report = connection.probe_streaming();
+    }
+    /// Already in HID only mode, the UART handshake would only get input
+    /// reports as replies.
+    resumed = init_report.has_value();
+    next = resumed ? InitStep::init_device_info : InitStep::init_request_mac;
+    return true;
+
+  case InitStep::init_device_info:
+    /// The MAC comes from the device info instead of the UART status.
+    try {
+      info = connection.request_device_info();
+      id = mac_to_string(info->mac);
+    }
+    catch (const RealController::SubcommandError &e) {
+    }
+    next = InitStep::init_rumble;
+    return true;
+
+  case InitStep::init_request_mac: {
+    std::optional<RealController::ControllerMAC> mac = connection.request_mac();
+    if (!mac) {
+      return false;
+    }
+    //printf("controller_type: %02x\n", mac->controller_type);
+    id = mac_to_string(mac->mac);
+    next = InitStep::init_handshake;
+    return true;
+  }
+
+  case InitStep::init_handshake:
+    next = InitStep::init_baudrate;
+    return connection.do_handshake();
+
+  case InitStep::init_baudrate:
+    next = InitStep::init_handshake_fast;
+    return connection.increment_baudrate();
+
+  case InitStep::init_handshake_fast:
+    next = InitStep::init_hid_only;
+    return connection.do_handshake();
+
+  case InitStep::init_hid_only:
+    next = InitStep::init_rumble;
+    return connection.enable_hid_only_mode();
+
+  case InitStep::init_rumble:
+    /// Over Bluetooth the serial number is the MAC.
+    if (id.empty()) {
+      id = connection.serial_number();
+    }
+    next = InitStep::init_imu;
+    return connection.toggle_rumble(true);
+
+  case InitStep::init_imu: {
+    next = InitStep::init_metadata;
+    /// The IMU is enabled before the report mode is set, so a controller left
+    /// streaming in the cached mode has it. If it was lost anyway, check_stream
+    /// turns it on again once the reports show it.
+    std::optional<RealController::DeviceMetadata> entry = cache != nullptr ? cache->find(id) : std::nullopt;
+    bool imu_enabled = init_report && (*init_report)[0] == report_mode && entry && entry->input_mode == report_mode;
+    return imu_enabled || connection.toggle_imu(true);
+  }
+
+  case InitStep::init_metadata:
+    load_metadata(cache);
+    // connection.set_imu_sensitivity(0x03, 0x00, 0x00, 0x01);
+    next = InitStep::init_report_mode;
+    return true;
+
+  case InitStep::init_report_mode:
+    next = InitStep::init_done;
+    /// Only skipped if the cache agrees this controller was left in this mode.
+    if (init_report && (*init_report)[0] == report_mode && metadata && metadata->input_mode == report_mode) {
+      return true;
+    }
+    if (!connection.set_input_report_mode(report_mode)) {
+      return false;
+    }
+    save_input_mode(report_mode);
+    return true;
+
+  case InitStep::init_done:
+    return true;
+  }
+  return false;
+}
+
 Controller::Controller(Controller &&other) noexcept: 
-  connection(std::move(other.connection)), n_controller(std::move(other.n_controller)), 
+  connection(std::move(other.connection)), n_controller(std::move(other.n_controller)), tx(std::move(other.tx)),
   blink_position(std::move(other.blink_position)), blink_counter(std::move(other.blink_counter)), 
-  closed(std::move(other.closed)) {
+  closed(std::move(other.closed)), resumed(std::move(other.resumed)), imu_cal(std::move(other.imu_cal)), imu_cal_known(other.imu_cal_known), stick_cal(std::move(other.stick_cal)), id(std::move(other.id)),
+  info(std::move(other.info)), body_colours(std::move(other.body_colours)),
+  device_cache(other.device_cache), metadata(std::move(other.metadata)),
+  attach_start(std::move(other.attach_start)), init_times(std::move(other.init_times)) {
 }
 
 Controller::~Controller() noexcept {
@@ -71,9 +196,21 @@ Controller::~Controller() noexcept {
 Controller &Controller::operator=(Controller &&other) noexcept {
   std::swap(connection, other.connection);
   std::swap(n_controller, other.n_controller);
+  std::swap(tx, other.tx);
   std::swap(closed, other.closed);
+  std::swap(resumed, other.resumed);
   std::swap(blink_position, other.blink_position);
   std::swap(blink_counter, other.blink_counter);
+  std::swap(imu_cal, other.imu_cal);
+  std::swap(imu_cal_known, other.imu_cal_known);
+  std::swap(stick_cal, other.stick_cal);
+  std::swap(id, other.id);
+  std::swap(info, other.info);
+  std::swap(body_colours, other.body_colours);
+  std::swap(device_cache, other.device_cache);
+  std::swap(metadata, other.metadata);
+  std::swap(attach_start, other.attach_start);
+  std::swap(init_times, other.init_times);
   return *this;
 }
 
@@ -83,9 +220,11 @@ RealController::Parser Controller::receive_input() {
   HidApi::DefaultPacket buff;
   size_t len;
   try {
+    tx.service(connection);
     do {
       len = connection.receive_input(buff, 15);
     } while (len == 0);
+    check_stream(buff, len);
   }
   catch (const HidApi::IOError &e) {
     if (!controller_loop) {
@@ -95,13 +234,32 @@ RealController::Parser Controller::receive_input() {
       throw;
     }
   }
-  return RealController::Parser(len, buff, no_packet);
+  return RealController::Parser(len, buff, no_packet, &imu_cal);
+}
+
+std::optional<RealController::Parser> Controller::receive_queued_input() {
+  HidApi::DefaultPacket buff;
+  size_t len;
+  try {
+    len = connection.receive_input(buff, 0);
+  }
+  catch (const HidApi::IOError &e) {
+    if (controller_loop) {
+      throw;
+    }
+    return std::nullopt;
+  }
+  if (len == 0) {
+    return std::nullopt;
+  }
+  check_stream(buff, len);
+  return RealController::Parser(len, buff, false, &imu_cal);
 }
 
 RealController::Parser Controller::request_input() {
   HidApi::DefaultPacket buff;
   size_t len = connection.request_input(buff);
-  return RealController::Parser(len, buff);
+  return RealController::Parser(len, buff, false, &imu_cal);
 }
 
 
@@ -111,8 +269,7 @@ void Controller::led(int number){
     bitwise = static_cast<uint8_t>(number);
   }
 
-  connection.set_player_leds(bitwise);
-  // connection.set_player_leds(bitwise);
+  tx.submit_leds(bitwise);
 }
 
 void Controller::blink() {
@@ -123,11 +280,11 @@ void Controller::blink() {
     }
   }
 
-  connection.set_player_leds(blink_array[blink_position]);
+  tx.submit_leds(blink_array[blink_position]);
 }
 
 void Controller::rumble(const Rumble::RumbleArray &left, const Rumble::RumbleArray &right) {
-  connection.send_rumble(left, right);
+  tx.submit_rumble(left, right);
 }
 void Controller::rumble(double high_freq, double low_freq, double high_amp, double low_amp) {
   Rumble::RumbleArray data = Rumble::rumble(high_freq, low_freq, high_amp, low_amp);
@@ -150,4 +307,253 @@ void Controller::close() {
     connection.disable_hid_only_mode();
     connection.send_reset();
   }
+  save_input_mode(0);
+}
+
+void Controller::check_stream(const HidApi::DefaultPacket &report, size_t len) {
+  /// Subcommand replies come in between, they don't count either way.
+  if (report[0] == 0x21) {
+    return;
+  }
+  wrong_mode_reports = report[0] == report_mode ? 0 : wrong_mode_reports + 1;
+  if (wrong_mode_reports >= stream_check_reports) {
+    wrong_mode_reports = 0;
+    const uint8_t mode = report_mode;
+    tx.submit_config(SubCmd::set_in_report, &mode, 1);
+  }
+
+  /// The IMU part of the report is zeroed while the IMU is disabled. Gravity
+  /// keeps it from being zero otherwise, even with the controller at rest.
+  if (report[0] != report_mode || len < 49) {
+    return;
+  }
+  bool imu_off = std::all_of(report.begin() + 13, report.begin() + 49, [](uint8_t b) { return b == 0; });
+  no_imu_reports = imu_off ? no_imu_reports + 1 : 0;
+  if (no_imu_reports >= stream_check_reports) {
+    no_imu_reports = 0;
+    const uint8_t enable = 0x01;
+    tx.submit_config(SubCmd::en_imu, &enable, 1);
+  }
+}
+
+void Controller::save_input_mode(uint8_t mode) {
+  if (device_cache == nullptr || !metadata || metadata->input_mode == mode) {
+    return;
+  }
+  metadata->input_mode = mode;
+  try {
+    device_cache->put(*metadata);
+  }
+  catch (const std::system_error &e) {
+    /// The next attach negotiates the mode again.
+  }
+}
+
+
+const RealController::ImuCalibration &Controller::imu_calibration() const {
+  return imu_cal;
+}
+
+bool Controller::has_imu_calibration() const {
+  return imu_cal_known;
+}
+
+void Controller::set_imu_calibration(const RealController::ImuCalibrationData &data) {
+  imu_cal = RealController::ImuCalibration(data);
+  imu_cal_known = true;
+}
+
+const std::optional<RealController::StickCalibrationData> &Controller::stick_calibration() const {
+  return stick_cal;
+}
+
+const std::string &Controller::identity() const {
+  return id;
+}
+
+const std::optional<RealController::DeviceInfo> &Controller::device_info() const {
+  return info;
+}
+
+const std::optional<RealController::Colours> &Controller::colours() const {
+  return body_colours;
+}
+
+const HidApi::Device &Controller::device() const {
+  return connection.device();
+}
+
+bool Controller::bluetooth() const {
+  return connection.Bluetooth();
+}
+
+void Controller::wait_until(std::chrono::steady_clock::time_point deadline) {
+  connection.wait_until(deadline);
+}
+
+std::chrono::steady_clock::time_point Controller::attach_time() const {
+  return attach_start;
+}
+
+std::chrono::steady_clock::duration Controller::init_time(InitStep step) const {
+  return init_times[step];
+}
+
+bool Controller::resumed_session() const {
+  return resumed;
+}
+
+const RealController::TxStats &Controller::tx_stats() const {
+  return tx.stats();
+}
+
+void Controller::load_metadata(RealController::DeviceCache *cache) {
+  using Metadata = RealController::DeviceMetadata;
+  std::optional<Metadata> cached;
+  if (cache != nullptr && !id.empty()) {
+    cached = cache->find(id);
+  }
+  Metadata entry = (cached && cached->is_fresh()) ? *cached : Metadata::make(id);
+  bool changed = !cached || !cached->is_fresh();
+
+  /// A single round trip tells if the cached entry is still this controller and firmware.
+  try {
+    RealController::DeviceInfo current = info ? *info : connection.request_device_info();
+    if (entry.has(Metadata::has_info) && !entry.info.same_device(current)) {
+      entry = Metadata::make(id);
+    }
+    if (!entry.has(Metadata::has_info)) {
+      entry.info = current;
+      entry.flags |= Metadata::has_info;
+      changed = true;
+    }
+  }
+  catch (const RealController::SubcommandError &e) {
+    /// Can't validate the cache, read everything again.
+    entry = Metadata::make(id);
+  }
+
+  /// Recalibrating from the console changes these without a firmware update.
+  try {
+    auto user_sticks = connection.spi_read<Metadata::user_sticks_size>(RealController::SpiAddress::user_left_stick);
+    auto user_imu = connection.spi_read<Metadata::user_imu_size>(RealController::SpiAddress::user_imu);
+    bool known = entry.has(Metadata::has_user_calibration);
+    if (!known || entry.user_sticks != user_sticks) {
+      entry.flags &= ~Metadata::has_sticks;
+    }
+    if (!known || entry.user_imu != user_imu) {
+      entry.flags &= ~Metadata::has_imu;
+    }
+    if (!known || entry.user_sticks != user_sticks || entry.user_imu != user_imu) {
+      entry.user_sticks = user_sticks;
+      entry.user_imu = user_imu;
+      entry.flags |= Metadata::has_user_calibration;
+      changed = true;
+    }
+  }
+  catch (const RealController::SubcommandError &e) {
+    entry.flags &= ~(Metadata::has_sticks | Metadata::has_imu | Metadata::has_user_calibration);
+  }
+
+  if (!entry.has(Metadata::has_imu)) {
+    try {
+      entry.imu = read_imu_calibration();
+      entry.flags |= Metadata::has_imu;
+      changed = true;
+    }
+    catch (const RealController::SubcommandError &e) {
+      /// Keep the nominal calibration.
+    }
+  }
+  if (!entry.has(Metadata::has_sticks)) {
+    try {
+      entry.sticks = read_stick_calibration();
+      entry.flags |= Metadata::has_sticks;
+      changed = true;
+    }
+    catch (const RealController::SubcommandError &e) {
+      /// Fall back to the manual calibration.
+    }
+  }
+  if (!entry.has(Metadata::has_colours)) {
+    try {
+      auto colour_block = connection.spi_read<RealController::Colours::size>(RealController::SpiAddress::colours);
+      entry.colours = RealController::Colours::parse(colour_block.data());
+      entry.flags |= Metadata::has_colours;
+      changed = true;
+    }
+    catch (const RealController::SubcommandError &e) {
+    }
+  }
+
+  if (entry.has(Metadata::has_info)) {
+    info = entry.info;
+  }
+  if (entry.has(Metadata::has_colours)) {
+    body_colours = entry.colours;
+  }
+  if (entry.has(Metadata::has_imu)) {
+    imu_cal = RealController::ImuCalibration(entry.imu);
+    imu_cal_known = true;
+  }
+  if (entry.has(Metadata::has_sticks) && entry.sticks.is_valid()) {
+    stick_cal = entry.sticks;
+  }
+
+  if (cache != nullptr && !id.empty() && changed) {
+    try {
+      cache->put(entry);
+    }
+    catch (const std::system_error &e) {
+      /// Only a slower attach next time.
+    }
+  }
+  if (cache != nullptr && !id.empty()) {
+    device_cache = cache;
+    metadata = entry;
+  }
+}
+
+RealController::ImuCalibrationData Controller::read_imu_calibration() {
+  auto user = connection.spi_read<2 + RealController::ImuCalibrationData::size>(RealController::SpiAddress::user_imu);
+  if (user[0] == RealController::user_calibration_magic[0] && user[1] == RealController::user_calibration_magic[1]) {
+    RealController::ImuCalibrationData data = RealController::ImuCalibrationData::parse(user.data() + 2);
+    if (data.is_valid()) {
+      return data;
+    }
+  }
+
+  auto factory = connection.spi_read<RealController::ImuCalibrationData::size>(RealController::SpiAddress::factory_imu);
+  return RealController::ImuCalibrationData::parse(factory.data());
+}
+
+RealController::StickCalibrationData Controller::read_stick_calibration() {
+  using Data = RealController::StickCalibrationData;
+  Data data;
+
+  auto factory = connection.spi_read<2 * Data::stick_size>(RealController::SpiAddress::factory_sticks);
+  auto user_left  = connection.spi_read<2 + Data::stick_size>(RealController::SpiAddress::user_left_stick);
+  auto user_right = connection.spi_read<2 + Data::stick_size>(RealController::SpiAddress::user_right_stick);
+
+  auto has_magic = [](const HidApi::GenericPacket<2 + Data::stick_size> &block) {
+    return block[0] == RealController::user_calibration_magic[0] && block[1] == RealController::user_calibration_magic[1];
+  };
+
+  if (has_magic(user_left)) {
+    data.set_left(user_left.data() + 2);
+  } else {
+    data.set_left(factory.data());
+  }
+  if (has_magic(user_right)) {
+    data.set_right(user_right.data() + 2);
+  } else {
+    data.set_right(factory.data() + Data::stick_size);
+  }
+
+  auto left_params  = connection.spi_read<Data::params_size>(RealController::SpiAddress::left_stick_params);
+  auto right_params = connection.spi_read<Data::params_size>(RealController::SpiAddress::right_stick_params);
+  data.set_deadzone(0, left_params.data());
+  data.set_deadzone(1, right_params.data());
+
+  return data;
 }
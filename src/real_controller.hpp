@@ -3,14 +3,42 @@
 #define PRO__REAL_CONTROLLER_HPP
 
 #include <array>
+#include <chrono>
+#include <optional>
+#include <string>
+#include "real_controller_calibration.hpp"
 #include "real_controller_connection.hpp"
+#include "real_controller_device_cache.hpp"
 #include "real_controller_parser.hpp"
 #include "real_controller_rumble.hpp"
+#include "real_controller_scheduler.hpp"
 
 namespace RealController {
+  /// Steps of the controller initialization. Over Bluetooth it starts at init_rumble.
+  enum InitStep {
+    init_probe,
+    init_device_info,   /// Only if the controller was still in HID only mode.
+    init_request_mac,
+    init_handshake,
+    init_baudrate,
+    init_handshake_fast,
+    init_hid_only,
+    init_rumble,
+    init_imu,
+    init_metadata,
+    init_report_mode,
+    init_done,
+  };
+
+  const char *init_step_name(InitStep step);
+
+
   class Controller {
   public:
-    Controller(const HidApi::Enumerate &device_info, unsigned short n_controll);
+    /// @param cache If given, the controller metadata is read from it and only
+    /// what's missing or stale is requested to the controller.
+    Controller(const HidApi::Enumerate &device_info, unsigned short n_controll,
+               RealController::DeviceCache *cache = nullptr);
     Controller(const Controller &other) = delete;
     Controller(Controller &&other) noexcept;
 
@@ -19,7 +47,10 @@ namespace RealController {
     Controller &operator=(const Controller &other) = delete;
     Controller &operator=(Controller &&other) noexcept;
 
+    /// Also sends the next queued command, see TxScheduler.
     RealController::Parser receive_input();
+    /// The next report if it already arrived, without waiting.
+    std::optional<RealController::Parser> receive_queued_input();
     RealController::Parser request_input();
 
     void led(int number = -1);
@@ -31,15 +62,95 @@ namespace RealController {
 
     void close();
 
+    const RealController::ImuCalibration &imu_calibration() const;
+    /// False if the controller's calibration couldn't be read, so the nominal one is used.
+    bool has_imu_calibration() const;
+    void set_imu_calibration(const RealController::ImuCalibrationData &data);
+    /// Empty if the controller doesn't have a valid stick calibration.
+    const std::optional<RealController::StickCalibrationData> &stick_calibration() const;
+    /// MAC or serial number, to tell controllers apart. Empty if unknown.
+    const std::string &identity() const;
+    /// Empty if the controller didn't answer.
+    const std::optional<RealController::DeviceInfo> &device_info() const;
+    const std::optional<RealController::Colours> &colours() const;
+    /// The controller was still in HID only mode, so the handshake was skipped.
+    bool resumed_session() const;
+
+    const HidApi::Device &device() const;
+    bool bluetooth() const;
+    /// Waits for the next frame, queueing the reports of the native USB backend meanwhile.
+    void wait_until(std::chrono::steady_clock::time_point deadline);
+
+    std::chrono::steady_clock::time_point attach_time() const;
+    /// Zero for the steps that weren't needed.
+    std::chrono::steady_clock::duration init_time(InitStep step) const;
+
+    const RealController::TxStats &tx_stats() const;
+
   private:
+    /**
+     * @brief Runs the initialization steps in order. Every step waits for its
+     * reply with a timeout and is retried a few times.
+     *
+     * @throw InitError if a step never gets a reply.
+     */
+    void initialize(RealController::DeviceCache *cache);
+    /// @return false if the step should be retried. Sets @param next otherwise.
+    bool run_init_step(InitStep step, RealController::DeviceCache *cache, InitStep &next);
+
+    /// Fills the device info, colours and calibrations, from @param cache when possible.
+    void load_metadata(RealController::DeviceCache *cache);
+
+    /**
+     * @brief Asks again for the report mode or the IMU if the controller
+     * dropped them while streaming, e.g. a Bluetooth controller that fell back
+     * to simple HID reports. Decided over several reports, and sent through the
+     * config class of the TX queue so it doesn't delay the rumble.
+     */
+    void check_stream(const HidApi::DefaultPacket &report, size_t len);
+
+    /// Remembers in the device cache that the controller streams in @param mode.
+    void save_input_mode(uint8_t mode);
+
+    /// User calibration if there's any, factory calibration otherwise.
+    RealController::ImuCalibrationData read_imu_calibration();
+    /// User calibration of each stick if there's any, factory calibration otherwise.
+    RealController::StickCalibrationData read_stick_calibration();
+
     RealController::ControllerConnection connection;
     unsigned short n_controller;
+    /// LEDs and rumble while streaming. The initialization talks to the connection directly.
+    RealController::TxScheduler tx;
 
     uint blink_position = 0;
     size_t blink_counter = 0;
     const size_t blink_length = 8;
 
     bool closed = true;
+    bool resumed = false;
+
+    /// Standard full mode, buttons, sticks and IMU at 60 Hz (120 Hz over USB).
+    static constexpr uint8_t report_mode{0x30};
+    /// Reports in a row in the wrong mode, or without IMU data, before asking again.
+    static constexpr uint32_t stream_check_reports{30};
+    uint32_t wrong_mode_reports = 0;
+    uint32_t no_imu_reports = 0;
+
+    RealController::ImuCalibration imu_cal;
+    bool imu_cal_known = false;
+    std::optional<RealController::StickCalibrationData> stick_cal;
+    std::string id;
+    std::optional<RealController::DeviceInfo> info;
+    std::optional<RealController::Colours> body_colours;
+    RealController::DeviceCache *device_cache = nullptr;
+    /// Entry of this controller, once the metadata is loaded.
+    std::optional<RealController::DeviceMetadata> metadata;
+
+    std::chrono::steady_clock::time_point attach_start;
+    std::array<std::chrono::steady_clock::duration, InitStep::init_done> init_times{};
+    /// First report received during the initialization, if it was already streaming.
+    std::optional<HidApi::DefaultPacket> init_report;
+    static constexpr size_t init_retries{3};
 
     const std::array<uint8_t, 8> player_led{0x01, 0x03, 0x07, 0x0f, 0x09, 0x05, 0x0d, 0x06};
 
@@ -0,0 +1,138 @@
+#include "real_controller_calibration.hpp"
+using namespace RealController;
+
+#include "utils.hpp"
+
+namespace {
+  int16_t read_int16(const uint8_t *data) {
+    return static_cast<int16_t>(data[0] | (data[1] << 8));
+  }
+
+  /// Precomputes `scale` and `offset` so `(raw * scale + offset) >> 16` equals
+  /// `(raw - origin) * target / (sensitivity - origin)`.
+  void fixed_point_coefficients(int16_t origin, int16_t sensitivity, int32_t target,
+                                int32_t &scale_q16, int64_t &offset_q16) {
+    int32_t span = sensitivity - origin;
+    if (span == 0) {
+      span = target;
+    }
+    scale_q16 = static_cast<int32_t>((static_cast<int64_t>(target) << 16) / span);
+    offset_q16 = -static_cast<int64_t>(origin) * scale_q16;
+  }
+
+  int16_t apply_q16(int16_t raw, int32_t scale_q16, int64_t offset_q16) {
+    int64_t value = (static_cast<int64_t>(raw) * scale_q16 + offset_q16) >> 16;
+    return Utils::Number::clamp<int16_t>(value, INT16_MIN, INT16_MAX);
+  }
+};
+
+
+ImuCalibrationData ImuCalibrationData::parse(const uint8_t *data) {
+  ImuCalibrationData cal;
+  for (size_t i = 0; i < 3; ++i) {
+    cal.accel_origin[i]      = read_int16(data + 0x00 + i * 2);
+    cal.accel_sensitivity[i] = read_int16(data + 0x06 + i * 2);
+    cal.gyro_origin[i]       = read_int16(data + 0x0C + i * 2);
+    cal.gyro_sensitivity[i]  = read_int16(data + 0x12 + i * 2);
+  }
+  return cal;
+}
+
+ImuCalibrationData ImuCalibrationData::defaults() {
+  ImuCalibrationData cal;
+  cal.accel_origin.fill(0);
+  cal.accel_sensitivity.fill(ImuCalibration::accel_counts_per_4g);
+  cal.gyro_origin.fill(0);
+  cal.gyro_sensitivity.fill(ImuCalibration::gyro_counts_per_936dps);
+  return cal;
+}
+
+bool ImuCalibrationData::is_valid() const {
+  for (size_t i = 0; i < 3; ++i) {
+    /// Erased flash reads as 0xFFFF.
+    if (accel_sensitivity[i] == -1 || gyro_sensitivity[i] == -1) {
+      return false;
+    }
+    if (accel_sensitivity[i] <= accel_origin[i] || gyro_sensitivity[i] <= gyro_origin[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+std::array<uint16_t, 6> StickCalibrationData::unpack(const uint8_t *data) {
+  std::array<uint16_t, 6> values;
+  for (size_t i = 0; i < 3; ++i) {
+    const uint8_t *pair = data + i * 3;
+    values[i * 2]     = ((pair[1] << 8) & 0xF00) | pair[0];
+    values[i * 2 + 1] = (pair[2] << 4) | (pair[1] >> 4);
+  }
+  return values;
+}
+
+void StickCalibrationData::set_left(const uint8_t *data) {
+  /// Max above center, center, min below center.
+  std::array<uint16_t, 6> v = unpack(data);
+  for (size_t i = 0; i < 2; ++i) {
+    Axis id = i == 0 ? Axis::axis_lx : Axis::axis_ly;
+    cen[id] = v[2 + i];
+    max[id] = cen[id] + v[i];
+    min[id] = cen[id] - v[4 + i];
+  }
+}
+
+void StickCalibrationData::set_right(const uint8_t *data) {
+  /// Center, min below center, max above center.
+  std::array<uint16_t, 6> v = unpack(data);
+  for (size_t i = 0; i < 2; ++i) {
+    Axis id = i == 0 ? Axis::axis_rx : Axis::axis_ry;
+    cen[id] = v[i];
+    min[id] = cen[id] - v[2 + i];
+    max[id] = cen[id] + v[4 + i];
+  }
+}
+
+void StickCalibrationData::set_deadzone(size_t stick, const uint8_t *params) {
+  /// Third value of the first block. The fourth is the range ratio.
+  deadzone.at(stick) = unpack(params)[2];
+}
+
+bool StickCalibrationData::is_valid() const {
+  for (const Axis &id: axis_ids) {
+    /// Also rejects erased flash, where every value reads as 0xFFF.
+    if (!(min[id] < cen[id] && cen[id] < max[id] && max[id] <= 0xFFF)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+ImuCalibration::ImuCalibration(): ImuCalibration(ImuCalibrationData::defaults()) {
+}
+
+ImuCalibration::ImuCalibration(const ImuCalibrationData &data): cal(data) {
+  if (!cal.is_valid()) {
+    cal = ImuCalibrationData::defaults();
+  }
+  for (size_t i = 0; i < 3; ++i) {
+    fixed_point_coefficients(cal.accel_origin[i], cal.accel_sensitivity[i], accel_counts_per_4g,
+                             accel_scale_q16[i], accel_offset_q16[i]);
+    fixed_point_coefficients(cal.gyro_origin[i], cal.gyro_sensitivity[i], gyro_counts_per_936dps,
+                             gyro_scale_q16[i], gyro_offset_q16[i]);
+  }
+}
+
+ImuSample ImuCalibration::apply(const ImuSample &raw) const {
+  ImuSample out;
+  for (size_t i = 0; i < 3; ++i) {
+    out.accel[i] = apply_q16(raw.accel[i], accel_scale_q16[i], accel_offset_q16[i]);
+    out.gyro[i]  = apply_q16(raw.gyro[i],  gyro_scale_q16[i],  gyro_offset_q16[i]);
+  }
+  return out;
+}
+
+const ImuCalibrationData &ImuCalibration::data() const {
+  return cal;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#ifndef PRO__REAL_CONTROLLER_CALIBRATION_HPP
+#define PRO__REAL_CONTROLLER_CALIBRATION_HPP
+
+#include <array>
+#include <cstdint>
+#include "real_controller_parser.hpp"
+
+namespace RealController {
+  namespace SpiAddress {
+    constexpr uint32_t factory_imu      { 0x6020 };
+    /// Two bytes of magic (0xB2 0xA1) followed by the calibration.
+    constexpr uint32_t user_imu         { 0x8026 };
+
+    /// Left stick followed by right stick, 9 bytes each.
+    constexpr uint32_t factory_sticks   { 0x603D };
+    /// Magic plus 9 bytes, for each stick.
+    constexpr uint32_t user_left_stick  { 0x8010 };
+    constexpr uint32_t user_right_stick { 0x801B };
+
+    /// Body, buttons, left grip and right grip, RGB each.
+    constexpr uint32_t colours         { 0x6050 };
+
+    constexpr uint32_t left_stick_params  { 0x6086 };
+    constexpr uint32_t right_stick_params { 0x6098 };
+  };
+
+  /// Magic that marks a user calibration block as present.
+  constexpr std::array<uint8_t, 2> user_calibration_magic{0xB2, 0xA1};
+
+  /// Calibration of the IMU, as stored in the SPI flash.
+  struct ImuCalibrationData {
+    std::array<int16_t, 3> accel_origin;
+    std::array<int16_t, 3> accel_sensitivity; /// Reading at 4 G.
+    std::array<int16_t, 3> gyro_origin;
+    std::array<int16_t, 3> gyro_sensitivity;  /// Reading at 936 dps.
+
+    static constexpr size_t size{24};
+
+    /// Parses the @param data 24 bytes block.
+    static ImuCalibrationData parse(const uint8_t *data);
+    /// Typical factory values.
+    static ImuCalibrationData defaults();
+
+    bool is_valid() const;
+  };
+
+  /// Calibration of both sticks, indexed by RealController::Axis.
+  struct StickCalibrationData {
+    std::array<uint16_t, 4> min;
+    std::array<uint16_t, 4> cen;
+    std::array<uint16_t, 4> max;
+    /// Deadzone of each stick (left, right), in raw counts.
+    std::array<uint16_t, 2> deadzone;
+
+    static constexpr size_t stick_size{9};
+    static constexpr size_t params_size{18};
+
+    /// Unpacks the 12 bit values of a 9 bytes stick block.
+    static std::array<uint16_t, 6> unpack(const uint8_t *data);
+
+    /// The order of the values differs between the left and right stick blocks.
+    void set_left(const uint8_t *data);
+    void set_right(const uint8_t *data);
+    void set_deadzone(size_t stick, const uint8_t *params);
+
+    bool is_valid() const;
+  };
+
+  /**
+   * @brief Turns raw IMU counts into calibrated units.
+   *
+   * Accelerometer comes out at 4096 counts per G and gyroscope at 0.070 dps
+   * per count, which are the nominal sensitivities of the raw values, so an
+   * uncalibrated sample is already roughly in the same units.
+   * The per-axis scale and offset are precomputed in Q16, so applying the
+   * calibration costs one multiply-add per axis.
+   */
+  class ImuCalibration {
+  public:
+    ImuCalibration();
+    ImuCalibration(const ImuCalibrationData &data);
+
+    ImuSample apply(const ImuSample &raw) const;
+
+    const ImuCalibrationData &data() const;
+
+    static constexpr int32_t accel_counts_per_4g{16384};
+    static constexpr int32_t gyro_counts_per_936dps{13371};
+
+  private:
+    ImuCalibrationData cal;
+
+    std::array<int32_t, 3> accel_scale_q16, gyro_scale_q16;
+    std::array<int64_t, 3> accel_offset_q16, gyro_offset_q16;
+  };
+};
+
+#endif
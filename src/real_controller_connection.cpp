@@ -1,16 +1,21 @@
 #include "real_controller_connection.hpp"
 using namespace RealController;
 
+#include <chrono>
+#include <stdexcept>
+
 
 ControllerConnection::ControllerConnection(const HidApi::Enumerate &device_info): hidw(device_info) {
-  std::string serial_number = hidw.get_serial_number();
-  bluetooth = false;
-  if (serial_number.find(':') != std::string::npos) {
-    bluetooth = true;
+  bluetooth = device_info.bluetooth();
+  if (bluetooth) {
+    use_framing<RealController::BluetoothFraming>();
+  } else {
+    use_framing<RealController::UsbUartFraming>();
   }
 }
 ControllerConnection::ControllerConnection(ControllerConnection &&other) noexcept: hidw(std::move(other.hidw)),
-  timing_counter(std::move(other.timing_counter)), bluetooth(std::move(other.bluetooth)) {
+  timing_counter(std::move(other.timing_counter)), bluetooth(std::move(other.bluetooth)),
+  tx_frame(std::move(other.tx_frame)), tx_offset(std::move(other.tx_offset)) {
 }
 
 ControllerConnection::~ControllerConnection() noexcept {
@@ -20,6 +25,8 @@ ControllerConnection &ControllerConnection::operator=(ControllerConnection &&oth
   std::swap(hidw, other.hidw);
   std::swap(timing_counter, other.timing_counter);
   std::swap(bluetooth, other.bluetooth);
+  std::swap(tx_frame, other.tx_frame);
+  std::swap(tx_offset, other.tx_offset);
   return *this;
 }
 
@@ -42,22 +49,50 @@ void ControllerConnection::setNonBlocking() {
   }
 }
 
-RealController::ControllerMAC ControllerConnection::request_mac(int milliseconds) {
-  HidApi::DefaultPacket response;
-  size_t len = send_uart(Uart::status);
-  if (len != 2) {
-    // throw ;
+const HidApi::Device &ControllerConnection::device() const {
+  return hidw;
+}
+
+void ControllerConnection::wait_until(std::chrono::steady_clock::time_point deadline) {
+  hidw.wait_until(deadline);
+}
+
+std::string ControllerConnection::serial_number() const {
+  try {
+    return hidw.get_serial_number();
+  }
+  catch (const HidApi::GetterError &e) {
+    return "";
   }
+}
 
-  len = hidw.read(response, milliseconds);
-  if (len < 10) {
-    // throw ;
+std::optional<HidApi::DefaultPacket> ControllerConnection::probe_streaming(int milliseconds) {
+  HidApi::DefaultPacket report;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+  while (true) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0) {
+      return std::nullopt;
+    }
+    size_t len = hidw.read(report, remaining);
+    /// Full reports (0x30) or subcommand replies (0x21) are only sent in HID only mode.
+    if (len > 13 && (report[0] == 0x30 || report[0] == 0x21)) {
+      return report;
+    }
   }
-  if (response[0] != Protocols::nin_response || response[1] != Uart::status
-      || response[2] != 0) {
+}
+
+std::optional<RealController::ControllerMAC> ControllerConnection::request_mac(int milliseconds) {
+  HidApi::DefaultPacket response;
+  send_uart(Uart::status);
+  if (!wait_uart_reply(Uart::status, response, milliseconds)) {
+    return std::nullopt;
+  }
+  if (response[2] != 0) {
+    /// USB connection wasn't closed properly, the next attempt should work.
     // RealController::printPacket(len, response);
     send_reset();
-    throw std::runtime_error("USB connection wasn't closed properly.");
+    return std::nullopt;
   }
 
   RealController::ControllerMAC data;
@@ -67,116 +102,139 @@ RealController::ControllerMAC ControllerConnection::request_mac(int milliseconds
   } 
   return data;
 }
-void ControllerConnection::do_handshake() {
+RealController::DeviceInfo ControllerConnection::request_device_info() {
   HidApi::DefaultPacket response;
-  size_t len = send_uart(Uart::handshake);
-  if (len != 2) {
-    // throw ;
+  for (size_t attempt = 0; attempt < subcommand_retries; ++attempt) {
+    send_subcommand(SubCmd::req_dev_info, empty, no_rumble, no_rumble);
+    if (wait_subcommand_reply(SubCmd::req_dev_info, response)) {
+      return RealController::DeviceInfo::parse(response.data() + 15);
+    }
   }
+  throw SubcommandError("SubcommandError: No reply to the device info request.");
+}
 
-  len = hidw.read(response);
-  if (len < 2) {
-    // throw ;
-  }
-  if (response[0] != Protocols::nin_response || response[1] != Uart::handshake) {
-    send_reset(); // ?
-    throw std::runtime_error(/*"USB connection wasn't closed properly."*/"..");
-  }
+bool ControllerConnection::do_handshake(int milliseconds) {
+  HidApi::DefaultPacket response;
+  send_uart(Uart::handshake);
+  return wait_uart_reply(Uart::handshake, response, milliseconds);
 }
-void ControllerConnection::increment_baudrate() {
+bool ControllerConnection::increment_baudrate(int milliseconds) {
   HidApi::DefaultPacket response;
-  size_t len = send_uart(Uart::inc_baudrate);
-  if (len != 2) {
-    // throw ;
-  }
-
-  len = hidw.read(response);
-  if (len < 2) {
-    // throw ;
-  }
-  if (response[0] != Protocols::nin_response || response[1] != Uart::inc_baudrate) {
-    send_reset(); // ?
-    throw std::runtime_error(/*"USB connection wasn't closed properly."*/"...");
-  }
+  send_uart(Uart::inc_baudrate);
+  return wait_uart_reply(Uart::inc_baudrate, response, milliseconds);
 }
-void ControllerConnection::enable_hid_only_mode() {
+bool ControllerConnection::enable_hid_only_mode(int milliseconds) {
   HidApi::DefaultPacket response;
   size_t len = send_uart(Uart::hid_only);
-  if (len != 2) {
-    // throw ;
-  }
-
-  len = hidw.read(response);
+  /// There's no reply to wait for, only input reports.
+  hidw.read(response, milliseconds);
+  return len == 2;
 }
-void ControllerConnection::disable_hid_only_mode() {
+void ControllerConnection::disable_hid_only_mode(int milliseconds) {
   HidApi::DefaultPacket response;
-  size_t len = send_uart(Uart::turn_off_hid);
-  if (len != 2) {
-    // throw ;
-  }
-
-  len = hidw.read(response);
+  send_uart(Uart::turn_off_hid);
+  hidw.read(response, milliseconds);
 }
-void ControllerConnection::send_reset() {
+void ControllerConnection::send_reset(int milliseconds) {
   HidApi::DefaultPacket response;
-  size_t len = send_uart(Uart::reset);
-  if (len != 2) {
-    // throw ;
-  }
-
-  len = hidw.read(response);
+  send_uart(Uart::reset);
+  hidw.read(response, milliseconds);
 }
 
 
 
-void ControllerConnection::set_player_leds(uint8_t bitwise) {
+void ControllerConnection::set_player_leds(uint8_t bitwise,
+                                           const HidApi::GenericPacket<4> &left_rumble,
+                                           const HidApi::GenericPacket<4> &right_rumble) {
   HidApi::GenericPacket<1> value {bitwise};
-  send_subcommand(SubCmd::set_leds, value, no_rumble, no_rumble);
-
-  HidApi::DefaultPacket response;
-  hidw.read(response);
+  send_subcommand(SubCmd::set_leds, value, left_rumble, right_rumble);
 }
 /*void ControllerConnection::get_player_leds() {
 }*/
 
-void ControllerConnection::set_input_report_mode(uint8_t mode) {
+size_t ControllerConnection::post_subcommand(SubCmd subcommand, const uint8_t *args, size_t length,
+                                             const HidApi::GenericPacket<4> &left_rumble,
+                                             const HidApi::GenericPacket<4> &right_rumble) {
+  if (rumble_frame_size + 1 + length > tx_frame_size - max_header_size) {
+    throw std::length_error("The subcommand doesn't fit the TX frame.");
+  }
+  uint8_t *payload = begin_rumble_frame(Cmd::sub_command, left_rumble, right_rumble);
+  payload[0] = subcommand;
+  memcpy(payload + 1, args, length);
+  return hidw.write(tx_offset + rumble_frame_size + 1 + length, tx_frame.data());
+}
+
+bool ControllerConnection::set_input_report_mode(uint8_t mode, int milliseconds) {
   HidApi::GenericPacket<1> buff{mode};
   send_subcommand(SubCmd::set_in_report, buff, no_rumble, no_rumble);
 
   HidApi::DefaultPacket response;
-  hidw.read(response);
+  return wait_subcommand_reply(SubCmd::set_in_report, response, milliseconds);
 }
 
-void ControllerConnection::toggle_imu(bool en) {
+bool ControllerConnection::toggle_imu(bool en, int milliseconds) {
   send_subcommand(SubCmd::en_imu, en ? enable : disable, no_rumble, no_rumble);
 
   HidApi::DefaultPacket response;
-  hidw.read(response);
+  return wait_subcommand_reply(SubCmd::en_imu, response, milliseconds);
 }
-void ControllerConnection::set_imu_sensitivity(uint8_t arg1, uint8_t arg2, uint8_t arg3, uint8_t arg4) {
+bool ControllerConnection::set_imu_sensitivity(uint8_t arg1, uint8_t arg2, uint8_t arg3, uint8_t arg4, int milliseconds) {
   HidApi::GenericPacket<4> imu_args{arg1, arg2, arg3, arg4};
   send_subcommand(SubCmd::set_imu, imu_args, no_rumble, no_rumble);
 
   HidApi::DefaultPacket response;
-  hidw.read(response);
+  return wait_subcommand_reply(SubCmd::set_imu, response, milliseconds);
 }
 
-void ControllerConnection::toggle_rumble(bool en) {
+bool ControllerConnection::toggle_rumble(bool en, int milliseconds) {
   send_subcommand(SubCmd::en_rumble, en ? enable : disable, no_rumble, no_rumble);
 
   HidApi::DefaultPacket response;
-  hidw.read(response);
+  return wait_subcommand_reply(SubCmd::en_rumble, response, milliseconds);
 }
 
 
 void ControllerConnection::send_rumble(const HidApi::GenericPacket<4> &left_rumble, 
                   const HidApi::GenericPacket<4> &right_rumble) {
-  send_command_with_rumble_data(Cmd::rumble_only, empty, left_rumble, right_rumble);
+  begin_rumble_frame(Cmd::rumble_only, left_rumble, right_rumble);
+  hidw.write(tx_offset + rumble_frame_size, tx_frame.data());
   // TODO: check if controller answers
 }
 
 
 
+bool ControllerConnection::wait_subcommand_reply(SubCmd subcommand, HidApi::DefaultPacket &response, int milliseconds) {
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::milliseconds(milliseconds);
+  while (true) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0) {
+      return false;
+    }
+    size_t len = hidw.read(response, remaining);
+    if (len > 14 && response[0] == 0x21 && response[14] == subcommand) {
+      hidw.add_round_trip(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+      return true;
+    }
+  }
+}
+
+bool ControllerConnection::wait_uart_reply(Uart uart, HidApi::DefaultPacket &response, int milliseconds) {
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::milliseconds(milliseconds);
+  while (true) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0) {
+      return false;
+    }
+    size_t len = hidw.read(response, remaining);
+    if (len > 2 && response[0] == Protocols::nin_response && response[1] == uart) {
+      hidw.add_round_trip(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+      return true;
+    }
+  }
+}
+
 size_t ControllerConnection::send_uart(Uart uart) {
   HidApi::GenericPacket<2> packet {Protocols::nintendo, (uint8_t)uart};
   return hidw.write(packet);
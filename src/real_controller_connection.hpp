@@ -2,10 +2,13 @@
 #ifndef PRO__REAL_CONTROLLER_CONNECTION_HPP
 #define PRO__REAL_CONTROLLER_CONNECTION_HPP
 
+#include <chrono>
 #include <cstring>
+#include <optional>
 #include "hidapi_wrapper.hpp"
 #include "real_controller_parser.hpp"
 #include "real_controller_packets.hpp"
+#include "real_controller_exceptions.hpp"
 
 namespace RealController {
   const HidApi::GenericPacket<0> empty  {{}};
@@ -15,6 +18,21 @@ namespace RealController {
 
   const HidApi::GenericPacket<4> no_rumble{0x00, 0x01, 0x40, 0x40};
 
+  /**
+   * @brief Framing policies of the output reports.
+   *
+   * Over USB every command is wrapped in a UART packet, over Bluetooth it's
+   * sent as is. The header is constant, so it's written once in the TX frame
+   * and the commands are built right after it.
+   */
+  struct UsbUartFraming {
+    static constexpr std::array<uint8_t, 8> header{Protocols::nintendo, Uart::uart_cmd, 0x00, 0x31, 0x00, 0x00, 0x00, 0x00};
+  };
+  struct BluetoothFraming {
+    static constexpr std::array<uint8_t, 0> header{};
+  };
+
+
   class ControllerConnection {
   public:
     ControllerConnection(const HidApi::Enumerate &device_info);
@@ -29,15 +47,34 @@ namespace RealController {
     bool Bluetooth() const;
     bool Usb() const;
 
+    /// Serial number reported by hidapi, empty if there's none.
+    std::string serial_number() const;
+
+    const HidApi::Device &device() const;
+    /// See HidApi::Device::wait_until.
+    void wait_until(std::chrono::steady_clock::time_point deadline);
+
     void setBlocking();
     void setNonBlocking();
 
-    RealController::ControllerMAC request_mac(int milliseconds=100);
-    void do_handshake();
-    void increment_baudrate();
-    void enable_hid_only_mode();
-    void disable_hid_only_mode();
-    void send_reset();
+    /**
+     * @brief Checks if the controller is already sending input reports, which
+     * happens when it was left in HID only mode (e.g. the driver was killed).
+     *
+     * @return The first report, empty if none arrived in @param milliseconds.
+     */
+    std::optional<HidApi::DefaultPacket> probe_streaming(int milliseconds=20);
+
+    /// Empty if there was no reply in @param milliseconds, or if the controller
+    /// had to be reset because the last connection wasn't closed properly.
+    std::optional<RealController::ControllerMAC> request_mac(int milliseconds=100);
+    RealController::DeviceInfo request_device_info();
+    /// The UART commands return false if the reply didn't arrive in @param milliseconds.
+    bool do_handshake(int milliseconds=100);
+    bool increment_baudrate(int milliseconds=100);
+    bool enable_hid_only_mode(int milliseconds=100);
+    void disable_hid_only_mode(int milliseconds=100);
+    void send_reset(int milliseconds=100);
 
 
     template <size_t length>
@@ -62,16 +99,56 @@ namespace RealController {
     }
 
 
-    void set_player_leds(uint8_t bitwise);
+    /// Doesn't wait for the reply, it's skipped by the input parser.
+    void set_player_leds(uint8_t bitwise,
+                         const HidApi::GenericPacket<4> &left_rumble = no_rumble,
+                         const HidApi::GenericPacket<4> &right_rumble = no_rumble);
     //void get_player_leds();
 
+    /// Sends @param length bytes of @param args without waiting for the reply.
+    size_t post_subcommand(SubCmd subcommand, const uint8_t *args, size_t length,
+                           const HidApi::GenericPacket<4> &left_rumble,
+                           const HidApi::GenericPacket<4> &right_rumble);
+
 
-    void set_input_report_mode(uint8_t mode);
+    /// The subcommands return false if the reply didn't arrive in @param milliseconds.
+    bool set_input_report_mode(uint8_t mode, int milliseconds=100);
 
-    void toggle_imu(bool en);
-    void set_imu_sensitivity(uint8_t arg1, uint8_t arg2, uint8_t arg3, uint8_t arg4);
+    bool toggle_imu(bool en, int milliseconds=100);
+    bool set_imu_sensitivity(uint8_t arg1, uint8_t arg2, uint8_t arg3, uint8_t arg4, int milliseconds=100);
 
-    void toggle_rumble(bool en);
+    bool toggle_rumble(bool en, int milliseconds=100);
+
+
+    /// Reads @param length bytes of the SPI flash, starting at @param address.
+    template <size_t length>
+    HidApi::GenericPacket<length> spi_read(uint32_t address) {
+      static_assert(length <= spi_max_read, "SPI reads are limited to 0x1D bytes.");
+      HidApi::GenericPacket<5> args{
+        static_cast<uint8_t>(address), static_cast<uint8_t>(address >> 8),
+        static_cast<uint8_t>(address >> 16), static_cast<uint8_t>(address >> 24),
+        static_cast<uint8_t>(length),
+      };
+
+      HidApi::DefaultPacket response;
+      for (size_t attempt = 0; attempt < subcommand_retries; ++attempt) {
+        send_subcommand(SubCmd::spi_read, args, no_rumble, no_rumble);
+        if (!wait_subcommand_reply(SubCmd::spi_read, response)) {
+          continue;
+        }
+        /// The reply echoes the requested address and size.
+        if (memcmp(response.data() + 15, args.data(), args.size()) != 0) {
+          continue;
+        }
+        HidApi::GenericPacket<length> data;
+        memcpy(data.data(), response.data() + 20, length);
+        return data;
+      }
+      throw SubcommandError("SubcommandError: No reply to SPI read at " + std::to_string(address) + ".");
+    }
+
+    static constexpr size_t spi_max_read{0x1D};
+    static constexpr size_t subcommand_retries{3};
 
 
     void send_rumble(const HidApi::GenericPacket<4> &left_rumble, 
@@ -81,51 +158,50 @@ namespace RealController {
   private:
     size_t send_uart(Uart uart);
 
-    template <size_t length>
-    size_t send_uart(const HidApi::GenericPacket<length> &data){
-      HidApi::GenericPacket<length + 8> packet;
-      packet.fill(0);
-      packet[0] = Protocols::nintendo;
-      packet[1] = Uart::uart_cmd;
-      packet[2] = 0x00; // length?
-      packet[3] = 0x31; // length?
-      if (length > 0) {
-        memcpy(packet.data() + 8, data.data(), length);
+    /// Reads until the reply to @param uart arrives, skipping everything else.
+    bool wait_uart_reply(Uart uart, HidApi::DefaultPacket &response, int milliseconds);
+
+    /**
+     * @brief Reads until the reply (0x21) to @param subcommand arrives,
+     * skipping the input reports in between.
+     *
+     * @return false if no reply arrived in @param milliseconds.
+     */
+    bool wait_subcommand_reply(SubCmd subcommand, HidApi::DefaultPacket &response, int milliseconds=100);
+
+    /// Selects the framing of the TX frame, writing its header once.
+    template <typename Framing>
+    void use_framing() {
+      static_assert(Framing::header.size() <= max_header_size, "The framing header doesn't fit the TX frame.");
+      if constexpr (Framing::header.size() > 0) {
+        memcpy(tx_frame.data(), Framing::header.data(), Framing::header.size());
       }
-      return hidw.write(packet);
+      tx_offset = Framing::header.size();
     }
 
-    template <size_t length>
-    size_t send_command(Cmd command,
-                        HidApi::GenericPacket<length> const &data) {
-      HidApi::GenericPacket<length + 1> buffer;
-      buffer[0] = command;
-      if (length > 0) {
-        memcpy(buffer.data() + 1, data.data(), length);
-      }
-
-      if (bluetooth) {
-        return hidw.write(buffer);
-      }
-      return send_uart(buffer);
+    /// Fills the command, timer and rumble fields after the framing header.
+    /// @return Where the command data starts.
+    uint8_t *begin_rumble_frame(Cmd command,
+                                const HidApi::GenericPacket<4> &left_rumble,
+                                const HidApi::GenericPacket<4> &right_rumble) {
+      uint8_t *payload = tx_frame.data() + tx_offset;
+      payload[0] = command;
+      payload[1] = timing_counter = (timing_counter + 1) & 0x0F;
+      memcpy(payload + 2, left_rumble.data(), left_rumble.size());
+      memcpy(payload + 6, right_rumble.data(), right_rumble.size());
+      return payload + rumble_frame_size;
     }
 
     template <size_t length>
-    size_t send_command_with_rumble_data(Cmd command,
-                           const HidApi::GenericPacket<length> &data, 
-                           const HidApi::GenericPacket<4> &left_rumble, 
-                           const HidApi::GenericPacket<4> &right_rumble) {
-      HidApi::GenericPacket<length + 9> buffer;
-      buffer[0] = timing_counter = (timing_counter + 1) & 0x0F;
-      for(size_t i = 0; i < 4; ++i){
-        buffer[1+i] =  left_rumble[i];
-        buffer[5+i] = right_rumble[i];
-      }
-
-      if (length > 0) {
-        memcpy(buffer.data() + 9, data.data(), length);
+    size_t send_command(Cmd command,
+                        HidApi::GenericPacket<length> const &data) {
+      static_assert(1 + length <= tx_frame_size - max_header_size, "The command doesn't fit the TX frame.");
+      uint8_t *payload = tx_frame.data() + tx_offset;
+      payload[0] = command;
+      if constexpr (length > 0) {
+        memcpy(payload + 1, data.data(), length);
       }
-      return send_command(command, buffer);
+      return hidw.write(tx_offset + 1 + length, tx_frame.data());
     }
 
     template <size_t length>
@@ -133,17 +209,26 @@ namespace RealController {
                            const HidApi::GenericPacket<length> &data, 
                            const HidApi::GenericPacket<4> &left_rumble, 
                            const HidApi::GenericPacket<4> &right_rumble) {
-      HidApi::GenericPacket<length + 1> buffer;
-      buffer[0] = subcommand;
-      if (length > 0) {
-        memcpy(buffer.data() + 1, data.data(), length);
+      static_assert(rumble_frame_size + 1 + length <= tx_frame_size - max_header_size, "The subcommand doesn't fit the TX frame.");
+      uint8_t *args = begin_rumble_frame(Cmd::sub_command, left_rumble, right_rumble);
+      args[0] = subcommand;
+      if constexpr (length > 0) {
+        memcpy(args + 1, data.data(), length);
       }
-      return send_command_with_rumble_data(Cmd::sub_command, buffer, left_rumble, right_rumble);
+      return hidw.write(tx_offset + rumble_frame_size + 1 + length, tx_frame.data());
     }
 
+    /// Command, timer and the rumble of both sides.
+    static constexpr size_t rumble_frame_size{10};
+    static constexpr size_t tx_frame_size{64};
+    static constexpr size_t max_header_size{8};
+
     HidApi::Device hidw;
     uint8_t timing_counter = 0x0F;
     bool bluetooth = false;
+    /// Output reports are built in place here, after the framing header.
+    HidApi::GenericPacket<tx_frame_size> tx_frame{};
+    size_t tx_offset = 0;
   };
 };
 
@@ -0,0 +1,38 @@
+#include "real_controller_device_cache.hpp"
+using namespace RealController;
+
+#include <chrono>
+#include <cstring>
+
+
+Colours Colours::parse(const uint8_t *data) {
+  Colours colours;
+  memcpy(colours.body.data(), data, 3);
+  memcpy(colours.buttons.data(), data + 3, 3);
+  memcpy(colours.left_grip.data(), data + 6, 3);
+  memcpy(colours.right_grip.data(), data + 9, 3);
+  return colours;
+}
+
+
+static int64_t now_s() {
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+DeviceMetadata DeviceMetadata::make(const std::string &key) {
+  DeviceMetadata metadata;
+  /// Clears the padding too, the entry is written as is.
+  memset(&metadata, 0, sizeof(metadata));
+  metadata.key = DeviceCache::make_key(key);
+  metadata.fetched_at = now_s();
+  return metadata;
+}
+
+bool DeviceMetadata::has(uint32_t flag) const {
+  return (flags & flag) != 0;
+}
+
+bool DeviceMetadata::is_fresh() const {
+  int64_t age = now_s() - fetched_at;
+  return age >= 0 && age < max_age_s;
+}
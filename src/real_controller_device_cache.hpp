@@ -0,0 +1,75 @@
+#pragma once
+#ifndef PRO__REAL_CONTROLLER_DEVICE_CACHE_HPP
+#define PRO__REAL_CONTROLLER_DEVICE_CACHE_HPP
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include "real_controller_calibration.hpp"
+#include "real_controller_parser.hpp"
+#include "record_store.hpp"
+
+namespace RealController {
+  /// Colours stored in the SPI flash, RGB.
+  struct Colours {
+    std::array<uint8_t, 3> body;
+    std::array<uint8_t, 3> buttons;
+    std::array<uint8_t, 3> left_grip;
+    std::array<uint8_t, 3> right_grip;
+
+    static constexpr size_t size{12};
+
+    static Colours parse(const uint8_t *data);
+  };
+
+  /**
+   * @brief What is read from a controller when it's attached, so a reconnect
+   * only has to check that it's still the same controller and firmware, and
+   * that its user calibration didn't change.
+   */
+  struct DeviceMetadata {
+    /// Both user stick blocks, magic included, from SpiAddress::user_left_stick.
+    static constexpr size_t user_sticks_size{2 * (2 + StickCalibrationData::stick_size)};
+    /// Magic and user IMU calibration, from SpiAddress::user_imu.
+    static constexpr size_t user_imu_size{2 + ImuCalibrationData::size};
+
+    /// Serial number or MAC of the controller, NUL padded.
+    std::array<char, 32> key;
+    uint32_t flags;
+    /// When the entry was first filled, in seconds since the epoch.
+    int64_t fetched_at;
+
+    RealController::DeviceInfo info;
+    RealController::Colours colours;
+    RealController::ImuCalibrationData imu;
+    RealController::StickCalibrationData sticks;
+    /// The user calibration as it was when `imu` and `sticks` were read.
+    /// Recalibrating from the console rewrites them.
+    std::array<uint8_t, user_sticks_size> user_sticks;
+    std::array<uint8_t, user_imu_size> user_imu;
+    /// Report mode the controller was left streaming in, 0 after a clean close.
+    uint8_t input_mode;
+
+    static constexpr uint32_t has_info    {1 << 0};
+    static constexpr uint32_t has_colours {1 << 1};
+    static constexpr uint32_t has_imu     {1 << 2};
+    static constexpr uint32_t has_sticks  {1 << 3};
+    static constexpr uint32_t has_user_calibration {1 << 4};
+
+    /// Entries older than this are read again from the controller.
+    static constexpr int64_t max_age_s{7 * 24 * 60 * 60};
+
+    static constexpr std::array<char, 4> magic{'P', 'C', 'D', 'C'};
+    static constexpr uint16_t version{1};
+
+    /// Empty entry for @param key, fetched now.
+    static DeviceMetadata make(const std::string &key);
+
+    bool has(uint32_t flag) const;
+    bool is_fresh() const;
+  };
+
+  using DeviceCache = Utils::RecordStore<DeviceMetadata>;
+};
+
+#endif
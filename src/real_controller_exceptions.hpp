@@ -67,6 +67,19 @@ namespace RealController {
     using InputError::InputError;
   };
 
+
+  class ConnectionError: public RealControllerError {
+    using RealControllerError::RealControllerError;
+  };
+
+  class SubcommandError: public ConnectionError {
+    using ConnectionError::ConnectionError;
+  };
+
+  class InitError: public ConnectionError {
+    using ConnectionError::ConnectionError;
+  };
+
 };
 
 #endif
@@ -432,3 +432,49 @@ size_t RealController::dpad_data_address(Dpad dpad, PacketType packet) {
     throw DpadError("DpadError: Tried to find address of unknown dpad button.");
   }
 }
+
+
+const char *RealController::imu_axis_name(ImuAxis axis) {
+  switch (axis) {
+  case ImuAxis::accel_x:
+    return "accel_x";
+  case ImuAxis::accel_y:
+    return "accel_y";
+  case ImuAxis::accel_z:
+    return "accel_z";
+  case ImuAxis::gyro_x:
+    return "gyro_x";
+  case ImuAxis::gyro_y:
+    return "gyro_y";
+  case ImuAxis::gyro_z:
+    return "gyro_z";
+  default:
+    throw MotionSensorError("MotionSensorError: Tried to get the name of unknown imu axis.");
+  }
+}
+
+size_t RealController::imu_data_address(ImuAxis axis, size_t sample, PacketType packet) {
+  if (packet != PacketType::standard_input_report) {
+    throw MotionSensorError("MotionSensorError: This packet type (" + std::to_string(packet) + ") does not contain imu data.");
+  }
+  if (sample >= imu_samples_per_report) {
+    throw MotionSensorError("MotionSensorError: Tried to find address of imu sample " + std::to_string(sample) + ".");
+  }
+  size_t address = 0x0D + sample * 0x0C;
+  switch (axis) {
+  case ImuAxis::accel_x:
+    return address + 0x00;
+  case ImuAxis::accel_y:
+    return address + 0x02;
+  case ImuAxis::accel_z:
+    return address + 0x04;
+  case ImuAxis::gyro_x:
+    return address + 0x06;
+  case ImuAxis::gyro_y:
+    return address + 0x08;
+  case ImuAxis::gyro_z:
+    return address + 0x0A;
+  default:
+    throw MotionSensorError("MotionSensorError: Tried to find address of unknown imu axis.");
+  }
+}
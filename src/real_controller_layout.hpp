@@ -73,6 +73,29 @@ namespace RealController {
   uint8_t dpad_bit_position(Dpad dpads, PacketType packet);
   uint8_t dpad_byte_value(Dpad dpads, PacketType packet);
   size_t dpad_data_address(Dpad dpad, PacketType packet);
+
+
+  enum ImuAxis {
+    accel_x,
+    accel_y,
+    accel_z,
+    gyro_x,
+    gyro_y,
+    gyro_z,
+    imu_none
+  };
+  const std::array<ImuAxis, 6> imu_axis_ids = {
+    ImuAxis::accel_x, ImuAxis::accel_y, ImuAxis::accel_z,
+    ImuAxis::gyro_x,  ImuAxis::gyro_y,  ImuAxis::gyro_z,
+  };
+
+  /// Each 0x30 report carries three IMU samples, taken ~5 ms apart.
+  static constexpr size_t imu_samples_per_report{3};
+
+  const char *imu_axis_name(ImuAxis axis);
+
+  /// Address of the low byte of a little-endian int16.
+  size_t imu_data_address(ImuAxis axis, size_t sample, PacketType packet);
 };
 
 #endif
@@ -40,8 +40,9 @@ namespace RealController {
 
   enum SubCmd {
     zero          = 0x00, // ??
-    //req_dev_info  = 0x02,
+    req_dev_info  = 0x02, /// Firmware version, controller type and MAC.
     set_in_report = 0x03, /// Set input report mode
+    spi_read      = 0x10, /// Read from the SPI flash. Up to 0x1D bytes at a time.
     set_leds      = 0x30,
     get_leds      = 0x31,
     //set_home_led  = 0x38,
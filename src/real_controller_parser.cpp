@@ -1,6 +1,7 @@
 #include "real_controller_parser.hpp"
 using namespace RealController;
 
+#include "real_controller_calibration.hpp"
 #include "real_controller_exceptions.hpp"
 #include "utils.hpp"
 
@@ -28,7 +29,26 @@ void RealController::printPacket(size_t packet_len, HidApi::DefaultPacket arr) {
   printPacket(packet_len, arr.data());
 }
 
-Parser::Parser(size_t packet_len, HidApi::DefaultPacket data,  bool no_packet): len(packet_len), dat(data), nopacket(no_packet) {
+DeviceInfo DeviceInfo::parse(const uint8_t *data) {
+  DeviceInfo info;
+  info.firmware_major = data[0];
+  info.firmware_minor = data[1];
+  info.controller_type = data[2];
+  for (size_t i = 0; i < info.mac.size(); ++i) {
+    info.mac[i] = data[4 + i];
+  }
+  info.spi_colours = data[11];
+  return info;
+}
+
+bool DeviceInfo::same_device(const DeviceInfo &other) const {
+  return firmware_major == other.firmware_major && firmware_minor == other.firmware_minor
+         && controller_type == other.controller_type && mac == other.mac;
+}
+
+Parser::Parser(size_t packet_len, HidApi::DefaultPacket data,  bool no_packet, const ImuCalibration *imu_calibration):
+  len(packet_len), dat(data), nopacket(no_packet),
+  received(std::chrono::steady_clock::now()), imu_cal(imu_calibration) {
   if (no_packet) return;
 
   type = PacketType::unknown;
@@ -151,6 +171,28 @@ bool Parser::is_dpad_pressed(Dpad dpad) const {
   return byte & dpad_byte_value(dpad);
 }
 
+int16_t Parser::get_imu_status(ImuAxis axis, size_t sample) const {
+  if (!has_imu_data()) {
+    throw MotionSensorError("MotionSensorError: This packet does not contain imu data.");
+  }
+  size_t low = imu_data_address(axis, sample);
+  return static_cast<int16_t>(dat[low] | (dat[low + 1] << 8));
+}
+
+ImuSample Parser::get_imu_sample(size_t sample) const {
+  ImuSample imu;
+  imu.accel[0] = get_imu_status(ImuAxis::accel_x, sample);
+  imu.accel[1] = get_imu_status(ImuAxis::accel_y, sample);
+  imu.accel[2] = get_imu_status(ImuAxis::accel_z, sample);
+  imu.gyro[0]  = get_imu_status(ImuAxis::gyro_x,  sample);
+  imu.gyro[1]  = get_imu_status(ImuAxis::gyro_y,  sample);
+  imu.gyro[2]  = get_imu_status(ImuAxis::gyro_z,  sample);
+  if (imu_cal != nullptr) {
+    return imu_cal->apply(imu);
+  }
+  return imu;
+}
+
 
 bool Parser::has_button_and_axis_data() const {
   if (nopacket) return false;
@@ -165,6 +207,22 @@ bool Parser::has_button_and_axis_data() const {
   }
 }
 
+bool Parser::has_imu_data() const {
+  if (nopacket) return false;
+  if (type != PacketType::standard_input_report) {
+    return false;
+  }
+  /// 0x21 reports carry a subcommand reply where the imu data would be.
+  if (dat[0x00] != 0x30 && dat[0x00] != 0x31) {
+    return false;
+  }
+  return len >= 0x0D + imu_samples_per_report * 0x0C;
+}
+
+std::chrono::steady_clock::time_point Parser::timestamp() const {
+  return received;
+}
+
 void Parser::print() const {
   printPacket(len, dat);
 }
@@ -196,3 +254,8 @@ uint8_t Parser::dpad_byte_value(Dpad dpad) const {
 size_t  Parser::dpad_data_address(Dpad dpad) const {
   return RealController::dpad_data_address(dpad, type);
 }
+
+
+size_t Parser::imu_data_address(ImuAxis axis, size_t sample) const {
+  return RealController::imu_data_address(axis, sample, type);
+}
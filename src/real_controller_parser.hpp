@@ -3,6 +3,7 @@
 #define PRO__REAL_CONTROLLER_PARSER_HPP
 
 #include <array>
+#include <chrono>
 #include "hidapi_wrapper.hpp"
 #include "real_controller_layout.hpp"
 
@@ -15,15 +16,52 @@ namespace RealController {
     std::array<uint8_t, 6> mac;
   };
 
+  /// Reply to the device info subcommand (0x02).
+  struct DeviceInfo {
+    uint8_t firmware_major;
+    uint8_t firmware_minor;
+    uint8_t controller_type;
+    std::array<uint8_t, 6> mac;
+    /// The colours in the SPI flash are used.
+    uint8_t spi_colours;
+
+    static constexpr size_t size{12};
+
+    static DeviceInfo parse(const uint8_t *data);
+
+    /// Same controller and firmware.
+    bool same_device(const DeviceInfo &other) const;
+  };
+
+  struct ImuSample {
+    std::array<int16_t, 3> accel;
+    std::array<int16_t, 3> gyro;
+  };
+
+  class ImuCalibration;
+
   class Parser {
   public:
-    Parser(size_t packet_len, HidApi::DefaultPacket data, bool no_packet=false);
+    /**
+     * @param imu_calibration If given, the imu samples are returned
+     * calibrated. Must outlive the parser.
+     */
+    Parser(size_t packet_len, HidApi::DefaultPacket data, bool no_packet=false,
+           const ImuCalibration *imu_calibration=nullptr);
 
     bool is_button_pressed(Buttons button) const;
     uint16_t get_axis_status(Axis axis) const;
     bool is_dpad_pressed(Dpad dpad) const;
+    /// Raw value of a single imu axis.
+    int16_t get_imu_status(ImuAxis axis, size_t sample) const;
+    /// Whole sample, calibrated if a calibration was given.
+    ImuSample get_imu_sample(size_t sample) const;
 
     bool has_button_and_axis_data() const;
+    bool has_imu_data() const;
+
+    /// Time at which the packet was received.
+    std::chrono::steady_clock::time_point timestamp() const;
 
     void print() const;
 
@@ -37,11 +75,15 @@ namespace RealController {
     uint8_t dpad_bit_position(Dpad dpad) const;
     uint8_t dpad_byte_value(Dpad dpad) const;
     size_t  dpad_data_address(Dpad dpad) const;
+
+    size_t imu_data_address(ImuAxis axis, size_t sample) const;
   private:
     size_t len = 0;
     HidApi::DefaultPacket dat;
     PacketType type = PacketType::packet_none;
     bool nopacket = false;
+    std::chrono::steady_clock::time_point received;
+    const ImuCalibration *imu_cal = nullptr;
   };
 };
 
@@ -0,0 +1,122 @@
+#include "real_controller_scheduler.hpp"
+using namespace RealController;
+
+#include <algorithm>
+#include <cstring>
+
+
+const char *RealController::tx_class_name(TxClass tx_class) {
+  switch (tx_class) {
+  case TxClass::tx_rumble: return "rumble";
+  case TxClass::tx_led:    return "led";
+  case TxClass::tx_config: return "config";
+  }
+  return "unknown";
+}
+
+
+void TxScheduler::set_interval(std::chrono::steady_clock::duration min_interval) {
+  interval = min_interval;
+}
+
+void TxScheduler::submit_rumble(const Rumble::RumbleArray &left, const Rumble::RumbleArray &right) {
+  TxClassStats &stats = tx_stats.classes[TxClass::tx_rumble];
+  ++stats.submitted;
+  if (pending_rumble) {
+    ++stats.merged;
+  }
+  pending_rumble = {left, right};
+  update_depth();
+}
+
+void TxScheduler::submit_leds(uint8_t bitwise) {
+  TxClassStats &stats = tx_stats.classes[TxClass::tx_led];
+  ++stats.submitted;
+  /// Blinking asks for the same pattern on every report.
+  if (pending_leds || (last_leds && *last_leds == bitwise)) {
+    ++stats.merged;
+  }
+  if (last_leds && *last_leds == bitwise) {
+    pending_leds.reset();
+  } else {
+    pending_leds = bitwise;
+  }
+  update_depth();
+}
+
+void TxScheduler::submit_config(SubCmd subcommand, const uint8_t *args, size_t length) {
+  TxClassStats &stats = tx_stats.classes[TxClass::tx_config];
+  ++stats.submitted;
+  length = std::min(length, max_config_args);
+
+  ConfigCommand *slot = nullptr;
+  for (size_t i = 0; i < config_count; ++i) {
+    if (config_queue[i].subcommand == subcommand) {
+      slot = &config_queue[i];
+      ++stats.merged;
+      break;
+    }
+  }
+  if (slot == nullptr) {
+    if (config_count >= config_capacity) {
+      ++stats.dropped;
+      return;
+    }
+    slot = &config_queue[config_count++];
+  }
+  slot->subcommand = subcommand;
+  memcpy(slot->args.data(), args, length);
+  slot->length = length;
+  update_depth();
+}
+
+bool TxScheduler::service(ControllerConnection &connection) {
+  auto now = std::chrono::steady_clock::now();
+  if (now - last_send < interval) {
+    return false;
+  }
+
+  std::array<Rumble::RumbleArray, 2> rumble_data{no_rumble, no_rumble};
+  bool with_rumble = pending_rumble.has_value();
+  if (with_rumble) {
+    rumble_data = *pending_rumble;
+    pending_rumble.reset();
+  }
+
+  if (pending_leds) {
+    connection.set_player_leds(*pending_leds, rumble_data[0], rumble_data[1]);
+    last_leds = pending_leds;
+    pending_leds.reset();
+    ++tx_stats.classes[TxClass::tx_led].sent;
+  }
+  else if (config_count > 0) {
+    /// The pending rumble rides along, so neither waits for the other.
+    const ConfigCommand &command = config_queue[0];
+    connection.post_subcommand(command.subcommand, command.args.data(), command.length, rumble_data[0], rumble_data[1]);
+    std::move(config_queue.begin() + 1, config_queue.begin() + config_count, config_queue.begin());
+    --config_count;
+    ++tx_stats.classes[TxClass::tx_config].sent;
+  }
+  else if (with_rumble) {
+    connection.send_rumble(rumble_data[0], rumble_data[1]);
+  }
+  else {
+    return false;
+  }
+
+  if (with_rumble) {
+    ++tx_stats.classes[TxClass::tx_rumble].sent;
+  }
+  last_send = now;
+  update_depth();
+  return true;
+}
+
+const TxStats &TxScheduler::stats() const {
+  return tx_stats;
+}
+
+void TxScheduler::update_depth() {
+  tx_stats.depth = config_count + (pending_rumble ? 1 : 0) + (pending_leds ? 1 : 0);
+  tx_stats.max_depth = std::max(tx_stats.max_depth, tx_stats.depth);
+}
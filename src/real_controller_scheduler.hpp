@@ -0,0 +1,91 @@
+#pragma once
+#ifndef PRO__REAL_CONTROLLER_SCHEDULER_HPP
+#define PRO__REAL_CONTROLLER_SCHEDULER_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include "real_controller_connection.hpp"
+#include "real_controller_packets.hpp"
+#include "real_controller_rumble.hpp"
+
+namespace RealController {
+  /// Priority classes of the outgoing commands, highest first.
+  enum TxClass {
+    tx_rumble,
+    tx_led,
+    tx_config,
+  };
+  static constexpr size_t tx_classes{3};
+
+  const char *tx_class_name(TxClass tx_class);
+
+  struct TxClassStats {
+    uint64_t submitted = 0;
+    uint64_t sent = 0;
+    /// Replaced by a newer command of the same kind before being sent.
+    uint64_t merged = 0;
+    /// Discarded because the queue was full.
+    uint64_t dropped = 0;
+  };
+
+  struct TxStats {
+    std::array<TxClassStats, tx_classes> classes;
+    size_t depth = 0;
+    size_t max_depth = 0;
+  };
+
+  /**
+   * @brief Queues the commands sent to the controller while it's streaming,
+   * and sends them paced for the link.
+   *
+   * Only the latest rumble and LED state are kept, and config subcommands
+   * replace a queued one with the same id. A subcommand always carries rumble
+   * data, so a pending rumble rides along with the LED or config command
+   * instead of waiting for its own slot.
+   */
+  class TxScheduler {
+  public:
+    /// The controller drops commands sent faster than this over Bluetooth.
+    static constexpr std::chrono::milliseconds bluetooth_interval{15};
+    static constexpr std::chrono::milliseconds usb_interval{0};
+    static constexpr size_t config_capacity{8};
+    static constexpr size_t max_config_args{8};
+
+    void set_interval(std::chrono::steady_clock::duration interval);
+
+    void submit_rumble(const Rumble::RumbleArray &left, const Rumble::RumbleArray &right);
+    void submit_leds(uint8_t bitwise);
+    /// @param args Up to max_config_args bytes.
+    void submit_config(SubCmd subcommand, const uint8_t *args, size_t length);
+
+    /// Sends the most important pending command, if the link allows it now.
+    /// @return true if something was sent.
+    bool service(ControllerConnection &connection);
+
+    const TxStats &stats() const;
+
+  private:
+    struct ConfigCommand {
+      SubCmd subcommand;
+      std::array<uint8_t, max_config_args> args;
+      size_t length;
+    };
+
+    void update_depth();
+
+    std::chrono::steady_clock::duration interval{0};
+    std::chrono::steady_clock::time_point last_send;
+
+    std::optional<std::array<Rumble::RumbleArray, 2>> pending_rumble;
+    std::optional<uint8_t> pending_leds;
+    std::optional<uint8_t> last_leds;
+    std::array<ConfigCommand, config_capacity> config_queue;
+    size_t config_count = 0;
+
+    TxStats tx_stats;
+  };
+};
+
+#endif
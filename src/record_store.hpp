@@ -0,0 +1,231 @@
+#pragma once
+#ifndef PRO__RECORD_STORE_HPP
+#define PRO__RECORD_STORE_HPP
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+namespace Utils {
+  /**
+   * @brief File of fixed size records, looked up by their key.
+   *
+   * The file is memory mapped, so looking up a record doesn't read anything
+   * besides the records before it. Updates write a new file and rename it
+   * over the old one, so a crash never leaves a half written store.
+   *
+   * Each controller runs its own driver process, so updates hold an flock on
+   * a lock file next to the store and merge into what's on disk at that
+   * moment, not into this process' own snapshot.
+   *
+   * @tparam Record Trivially copyable, with a `key` array and static `magic`
+   * and `version` identifying its layout. Files from another layout are
+   * ignored, and replaced on the next update.
+   */
+  template <typename Record>
+  class RecordStore {
+    static_assert(std::is_trivially_copyable<Record>::value, "Records are stored as is.");
+
+  public:
+    RecordStore(const std::string &store_path): path(store_path) {
+      map();
+    }
+    RecordStore(const RecordStore &other) = delete;
+    RecordStore(RecordStore &&other) = delete;
+
+    ~RecordStore() noexcept {
+      unmap();
+    }
+
+    RecordStore &operator=(const RecordStore &other) = delete;
+    RecordStore &operator=(RecordStore &&other) = delete;
+
+    /// Keys are NUL padded strings, longer ones are truncated.
+    static decltype(Record::key) make_key(const std::string &key) {
+      decltype(Record::key) padded{};
+      strncpy(padded.data(), key.c_str(), padded.size() - 1);
+      return padded;
+    }
+
+    std::optional<Record> find(const std::string &key) const {
+      std::lock_guard<std::mutex> lock(store_mutex);
+      decltype(Record::key) wanted = make_key(key);
+      const Record *list = records();
+      for (size_t i = 0; i < count(); ++i) {
+        if (list[i].key == wanted) {
+          return list[i];
+        }
+      }
+      return std::nullopt;
+    }
+
+    /// True if any record satisfies @param pred, for lookups that don't know the key yet.
+    template <typename Predicate>
+    bool any_of(Predicate pred) const {
+      std::lock_guard<std::mutex> lock(store_mutex);
+      const Record *list = records();
+      return std::any_of(list, list + count(), pred);
+    }
+
+    /// Adds or replaces the record with the same key. Safe to call from any
+    /// thread and from several processes.
+    void put(const Record &record) {
+      std::lock_guard<std::mutex> lock(store_mutex);
+      FileLock file_lock(path + ".lock");
+
+      /// Another process may have updated it since it was mapped.
+      unmap();
+      map();
+
+      std::vector<Record> updated(records(), records() + count());
+      bool replaced = false;
+      for (Record &old: updated) {
+        if (old.key == record.key) {
+          old = record;
+          replaced = true;
+        }
+      }
+      if (!replaced) {
+        updated.push_back(record);
+      }
+
+      Header header{Record::magic, Record::version, sizeof(Record), static_cast<uint32_t>(updated.size()), 0};
+
+      /// Same directory, so the rename stays atomic.
+      std::string temp_path = path + ".XXXXXX";
+      int fd = mkstemp(temp_path.data());
+      if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Failed to create " + temp_path);
+      }
+      bool written = fchmod(fd, 0644) == 0;
+      written = written && write(fd, &header, sizeof(header)) == sizeof(header);
+      ssize_t records_size = sizeof(Record) * updated.size();
+      written = written && write(fd, updated.data(), records_size) == records_size;
+      written = written && fsync(fd) == 0;
+      int error = errno;
+      close(fd);
+      if (!written) {
+        unlink(temp_path.c_str());
+        throw std::system_error(error, std::generic_category(), "Failed to write " + temp_path);
+      }
+      if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        int rename_error = errno;
+        unlink(temp_path.c_str());
+        throw std::system_error(rename_error, std::generic_category(), "Failed to replace " + path);
+      }
+
+      unmap();
+      map();
+    }
+
+  private:
+    /// Exclusive flock, held until destroyed.
+    class FileLock {
+    public:
+      FileLock(const std::string &lock_path) {
+        fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+          throw std::system_error(errno, std::generic_category(), "Failed to open " + lock_path);
+        }
+        while (flock(fd, LOCK_EX) < 0) {
+          if (errno != EINTR) {
+            int error = errno;
+            close(fd);
+            throw std::system_error(error, std::generic_category(), "Failed to lock " + lock_path);
+          }
+        }
+      }
+      FileLock(const FileLock &other) = delete;
+      FileLock &operator=(const FileLock &other) = delete;
+
+      ~FileLock() noexcept {
+        /// Closing releases the lock.
+        close(fd);
+      }
+
+    private:
+      int fd = -1;
+    };
+
+    struct Header {
+      std::array<char, 4> magic;
+      uint16_t version;
+      uint16_t record_size;
+      uint32_t count;
+      uint32_t reserved;
+    };
+
+    /// Maps the file, leaving the store empty if it's missing or not readable.
+    void map() {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return;
+      }
+      struct stat info;
+      if (fstat(fd, &info) < 0 || static_cast<size_t>(info.st_size) < sizeof(Header)) {
+        close(fd);
+        return;
+      }
+      void *ptr = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      /// The mapping stays valid after closing the descriptor.
+      close(fd);
+      if (ptr == MAP_FAILED) {
+        return;
+      }
+      mapping = static_cast<const uint8_t *>(ptr);
+      mapping_size = info.st_size;
+
+      const Header *header = reinterpret_cast<const Header *>(mapping);
+      if (header->magic != Record::magic || header->version != Record::version
+          || header->record_size != sizeof(Record)
+          || mapping_size < sizeof(Header) + header->count * sizeof(Record)) {
+        unmap();
+      }
+    }
+
+    void unmap() noexcept {
+      if (mapping != nullptr) {
+        munmap(const_cast<uint8_t *>(mapping), mapping_size);
+      }
+      mapping = nullptr;
+      mapping_size = 0;
+    }
+
+    const Record *records() const {
+      if (mapping == nullptr) {
+        return nullptr;
+      }
+      return reinterpret_cast<const Record *>(mapping + sizeof(Header));
+    }
+
+    size_t count() const {
+      if (mapping == nullptr) {
+        return 0;
+      }
+      return reinterpret_cast<const Header *>(mapping)->count;
+    }
+
+    std::string path;
+
+    mutable std::mutex store_mutex;
+    const uint8_t *mapping = nullptr;
+    size_t mapping_size = 0;
+  };
+};
+
+#endif
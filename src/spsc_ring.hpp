@@ -0,0 +1,179 @@
+#pragma once
+#ifndef PRO__SPSC_RING_HPP
+#define PRO__SPSC_RING_HPP
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+
+namespace Utils {
+  /// Size of the cache lines, the indices of the rings are kept on separate ones.
+  static constexpr size_t cache_line_size{64};
+
+  /**
+   * @brief Wait-free ring between one producer thread and one consumer thread.
+   *
+   * Each side owns its index on a separate cache line, with a cached copy of
+   * the other one, so it only touches the other line when the ring looks full
+   * or empty. A full ring refuses the item instead of waiting.
+   *
+   * @tparam capacity Power of two.
+   */
+  template <typename T, size_t capacity>
+  class SpscRing {
+    static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "The capacity must be a power of two.");
+
+  public:
+    /// Producer side. @return false if the ring is full.
+    bool try_push(const T &item) {
+      size_t current = head.load(std::memory_order_relaxed);
+      if (current - tail_cache >= capacity) {
+        tail_cache = tail.load(std::memory_order_acquire);
+        if (current - tail_cache >= capacity) {
+          return false;
+        }
+      }
+      slots[current & mask] = item;
+      head.store(current + 1, std::memory_order_release);
+      return true;
+    }
+
+    /// Consumer side. @return false if the ring is empty.
+    bool try_pop(T &item) {
+      size_t current = tail.load(std::memory_order_relaxed);
+      if (current == head_cache) {
+        head_cache = head.load(std::memory_order_acquire);
+        if (current == head_cache) {
+          return false;
+        }
+      }
+      item = slots[current & mask];
+      tail.store(current + 1, std::memory_order_release);
+      return true;
+    }
+
+    /// Approximate when called while the other side is running.
+    size_t size() const {
+      return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+  private:
+    static constexpr size_t mask{capacity - 1};
+
+    /// Written by the producer.
+    alignas(cache_line_size) std::atomic<size_t> head{0};
+    size_t tail_cache = 0;
+
+    /// Written by the consumer.
+    alignas(cache_line_size) std::atomic<size_t> tail{0};
+    size_t head_cache = 0;
+
+    alignas(cache_line_size) std::array<T, capacity> slots{};
+  };
+
+  /**
+   * @brief Latest value shared between one writer thread and one reader
+   * thread, neither of them ever waits.
+   *
+   * The writer fills its own slot and swaps it with the middle one, the
+   * reader swaps its own slot with the middle one if it holds something new.
+   * Values written between two reads are skipped, the reader always gets the
+   * newest one.
+   */
+  template <typename T>
+  class TripleBuffer {
+  public:
+    /// Writer side.
+    void write(const T &value) {
+      slots[back].value = value;
+      back = middle.exchange(back | fresh, std::memory_order_acq_rel) & index_mask;
+    }
+
+    /// Reader side. @return false if nothing was written since the last read.
+    bool read(T &value) {
+      if ((middle.load(std::memory_order_relaxed) & fresh) == 0) {
+        return false;
+      }
+      front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+      value = slots[front].value;
+      return true;
+    }
+
+  private:
+    static constexpr uint8_t index_mask{0x3};
+    static constexpr uint8_t fresh{0x4};
+
+    struct alignas(cache_line_size) Slot {
+      T value{};
+    };
+    std::array<Slot, 3> slots;
+
+    /// Index of the slot in the middle, with the fresh flag.
+    alignas(cache_line_size) std::atomic<uint8_t> middle{1};
+    /// Only used by the writer.
+    alignas(cache_line_size) uint8_t back = 0;
+    /// Only used by the reader.
+    alignas(cache_line_size) uint8_t front = 2;
+  };
+
+  /**
+   * @brief Wakes the consumer of a ring. Notifying never blocks, several
+   * notifications before a wait are folded into one.
+   */
+  class Notifier {
+  public:
+    Notifier() {
+      fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Failed to create an eventfd");
+      }
+    }
+    Notifier(const Notifier &other) = delete;
+    Notifier(Notifier &&other) = delete;
+
+    ~Notifier() noexcept {
+      close(fd);
+    }
+
+    Notifier &operator=(const Notifier &other) = delete;
+    Notifier &operator=(Notifier &&other) = delete;
+
+    void notify() {
+      uint64_t one = 1;
+      ssize_t ret = write(fd, &one, sizeof(one));
+      (void)ret;
+    }
+
+    /// @return false if nothing was notified in @param milliseconds.
+    bool wait(int milliseconds) {
+      struct pollfd pfd{fd, POLLIN, 0};
+      if (poll(&pfd, 1, milliseconds) <= 0) {
+        return false;
+      }
+      clear();
+      return true;
+    }
+
+    void clear() {
+      uint64_t count;
+      ssize_t ret = read(fd, &count, sizeof(count));
+      (void)ret;
+    }
+
+    /// To wait on it together with other descriptors.
+    int descriptor() const {
+      return fd;
+    }
+
+  private:
+    int fd = -1;
+  };
+};
+
+#endif
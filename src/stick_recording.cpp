@@ -0,0 +1,86 @@
+#include "stick_recording.hpp"
+using namespace Sticks;
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+
+Recorder::Recorder(const std::string &path) {
+  file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    throw std::system_error(errno, std::generic_category(), "Failed to open " + path);
+  }
+  fprintf(file, "%s\n", header);
+}
+
+Recorder::~Recorder() noexcept {
+  fclose(file);
+}
+
+void Recorder::add(std::chrono::steady_clock::time_point time, const std::array<uint16_t, 4> &axes) {
+  if (start.time_since_epoch().count() == 0) {
+    start = time;
+  }
+  long long time_us = std::chrono::duration_cast<std::chrono::microseconds>(time - start).count();
+  fprintf(file, "%lld %u %u %u %u\n", time_us, axes[0], axes[1], axes[2], axes[3]);
+}
+
+
+std::vector<Sample> Sticks::load_recording(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "r");
+  if (file == nullptr) {
+    throw std::system_error(errno, std::generic_category(), "Failed to open " + path);
+  }
+
+  std::vector<Sample> samples;
+  std::array<char, 256> line;
+  size_t line_number = 0;
+  while (fgets(line.data(), line.size(), file) != nullptr) {
+    ++line_number;
+    if (line[0] == '#' || line[0] == '\n') {
+      continue;
+    }
+    long long time_us;
+    std::array<unsigned int, 4> axes;
+    if (sscanf(line.data(), "%lld %u %u %u %u", &time_us, &axes[0], &axes[1], &axes[2], &axes[3]) != 5) {
+      fclose(file);
+      throw std::runtime_error(path + ":" + std::to_string(line_number) + ": expected 'time_us lx ly rx ry'.");
+    }
+    Sample sample{time_us, {}};
+    for (size_t i = 0; i < axes.size(); ++i) {
+      sample.axes[i] = std::min(axes[i], (unsigned int)axis_max);
+    }
+    samples.push_back(sample);
+  }
+  fclose(file);
+  return samples;
+}
+
+
+ReplayResult Sticks::replay(const std::vector<Sample> &samples, const PredictorSettings &settings) {
+  ReplayResult result;
+  std::array<Predictor, 4> predictors;
+  predictors.fill(Predictor(settings));
+
+  for (size_t k = 0; k < samples.size(); ++k) {
+    const Sample &sample = samples[k];
+    double time = sample.time_us / 1000000.0;
+    if (k > 0) {
+      const Sample &previous = samples[k - 1];
+      result.report_interval.add((sample.time_us - previous.time_us) / 1000.0);
+      for (size_t i = 0; i < predictors.size(); ++i) {
+        result.held_error.add(std::abs((double)sample.axes[i] - previous.axes[i]));
+        result.predicted_error.add(std::fabs(std::round(predictors[i].predict(time)) - sample.axes[i]));
+      }
+      ++result.samples;
+    }
+    for (size_t i = 0; i < predictors.size(); ++i) {
+      predictors[i].add(sample.axes[i], time);
+    }
+  }
+  return result;
+}
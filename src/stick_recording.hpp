@@ -0,0 +1,69 @@
+#pragma once
+#ifndef PRO__STICK_RECORDING_HPP
+#define PRO__STICK_RECORDING_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "sticks.hpp"
+#include "utils.hpp"
+
+namespace Sticks {
+  /// The four axes as sent, when the report was received.
+  struct Sample {
+    /// Since the first sample.
+    int64_t time_us;
+    std::array<uint16_t, 4> axes;
+  };
+
+  /**
+   * @brief Writes the stick values of a session to a text file, one report
+   * per line, to replay them later with replay().
+   */
+  class Recorder {
+  public:
+    Recorder(const std::string &path);
+    Recorder(const Recorder &other) = delete;
+    Recorder(Recorder &&other) = delete;
+
+    ~Recorder() noexcept;
+
+    Recorder &operator=(const Recorder &other) = delete;
+    Recorder &operator=(Recorder &&other) = delete;
+
+    void add(std::chrono::steady_clock::time_point time, const std::array<uint16_t, 4> &axes);
+
+    static constexpr const char *header{"# procon stick recording v1: time_us lx ly rx ry"};
+
+  private:
+    FILE *file = nullptr;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  std::vector<Sample> load_recording(const std::string &path);
+
+
+  struct ReplayResult {
+    uint64_t samples = 0;
+    /// Between the recorded reports, in milliseconds.
+    Utils::Stats report_interval;
+    /// Distance to the next report, in axis counts, holding the last value.
+    Utils::Stats held_error;
+    /// Same, with the value extrapolated up to the next report.
+    Utils::Stats predicted_error;
+  };
+
+  /**
+   * @brief Predicts each recorded report from the ones before it and
+   * compares it with the value that arrived.
+   *
+   * The reports are the only known values, so the error is measured at their
+   * times, which is the furthest an output tick can be from the last report.
+   */
+  ReplayResult replay(const std::vector<Sample> &samples, const PredictorSettings &settings);
+};
+
+#endif
@@ -0,0 +1,485 @@
+#include "sticks.hpp"
+using namespace Sticks;
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "utils.hpp"
+
+
+AxisLut::AxisLut() {
+  build_identity(false);
+}
+
+void AxisLut::build(uint16_t min, uint16_t cen, uint16_t max, bool invert) {
+  for (size_t raw = 0; raw < lut_size; ++raw) {
+    long double val = 0.5L;
+    if (raw < cen) {
+      if (cen > min) {
+        val = (long double)((int)raw - min) / (long double)(cen - min) / 2.L;
+      }
+    } else if (max > cen) {
+      val = (long double)(raw - cen) / (long double)(max - cen) / 2.L;
+      val += 0.5L;
+    }
+    uint16_t mapped = Utils::Number::clamp<uint16_t>(val * axis_max, 0x000, axis_max);
+    table[raw] = invert ? axis_max - mapped : mapped;
+  }
+}
+
+void AxisLut::build_identity(bool invert) {
+  for (size_t raw = 0; raw < lut_size; ++raw) {
+    table[raw] = invert ? axis_max - raw : raw;
+  }
+}
+
+
+
+bool StickProfile::is_identity() const {
+  return inner <= 0.0 && outer >= 1.0 && anti_deadzone <= 0.0 && curve == CurveType::curve_linear;
+}
+
+double StickProfile::response(double magnitude) const {
+  if (magnitude <= inner) {
+    return 0.0;
+  }
+  double t = 1.0;
+  if (outer > inner) {
+    t = Utils::Number::clamp<double>((magnitude - inner) / (outer - inner), 0.0, 1.0);
+  }
+
+  switch (curve) {
+  case CurveType::curve_power:
+    t = std::pow(t, curve_param);
+    break;
+  case CurveType::curve_scurve:
+    t = 0.5 + 0.5 * std::tanh(curve_param * (t - 0.5)) / std::tanh(curve_param * 0.5);
+    break;
+  case CurveType::curve_points: {
+    double x0 = 0.0, y0 = 0.0;
+    for (const auto &point: points) {
+      if (t <= point.first) {
+        double span = point.first - x0;
+        t = span > 0.0 ? y0 + (t - x0) * (point.second - y0) / span : point.second;
+        x0 = -1.0;
+        break;
+      }
+      x0 = point.first;
+      y0 = point.second;
+    }
+    if (x0 >= 0.0) {
+      /// Past the last point, up to (1, 1).
+      double span = 1.0 - x0;
+      t = span > 0.0 ? y0 + (t - x0) * (1.0 - y0) / span : 1.0;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+
+  return anti_deadzone + (1.0 - anti_deadzone) * t;
+}
+
+void StickProfile::set_curve(const std::string &description) {
+  std::string name = description.substr(0, description.find(':'));
+  std::string args = description.find(':') == std::string::npos ? "" : description.substr(description.find(':') + 1);
+
+  if (name == "linear") {
+    curve = CurveType::curve_linear;
+  } else if (name == "power" || name == "scurve") {
+    curve = name == "power" ? CurveType::curve_power : CurveType::curve_scurve;
+    curve_param = args.empty() ? 2.0 : std::stod(args);
+    if (curve_param <= 0.0) {
+      throw std::domain_error("Curve parameter must be positive, got " + args + ".");
+    }
+  } else if (name == "points") {
+    curve = CurveType::curve_points;
+    points.clear();
+    size_t start = 0;
+    while (start < args.size()) {
+      size_t end = args.find(',', start);
+      std::string point = args.substr(start, end == std::string::npos ? std::string::npos : end - start);
+      size_t sep = point.find(':');
+      if (sep == std::string::npos) {
+        throw std::invalid_argument("Expected X:Y curve point, got " + point + ".");
+      }
+      double x = std::stod(point.substr(0, sep));
+      double y = std::stod(point.substr(sep + 1));
+      if (x < 0.0 || x > 1.0 || y < 0.0 || y > 1.0) {
+        throw std::domain_error("Curve points must be in [0, 1], got " + point + ".");
+      }
+      points.emplace_back(x, y);
+      if (end == std::string::npos) {
+        break;
+      }
+      start = end + 1;
+    }
+    std::sort(points.begin(), points.end());
+  } else {
+    throw std::invalid_argument("Unknown curve " + description + ". Use --help for options!");
+  }
+}
+
+
+StickShaper::StickShaper() {
+  table.fill(0);
+}
+
+void StickShaper::build(const StickProfile &profile) {
+  identity = profile.is_identity();
+  shape = profile.shape;
+  if (identity) {
+    return;
+  }
+
+  for (size_t r = 0; r <= max_radius; ++r) {
+    double out = profile.response(r / (double)half_range) * half_range;
+    if (shape == DeadzoneShape::deadzone_axial) {
+      table[r] = static_cast<int32_t>(std::lround(out));
+    } else {
+      table[r] = r == 0 ? 0 : static_cast<int32_t>(std::lround(out * 65536.0 / r));
+    }
+  }
+}
+
+void StickShaper::apply(uint16_t &x, uint16_t &y) const {
+  if (identity) {
+    return;
+  }
+
+  int32_t dx = static_cast<int32_t>(x) - axis_center;
+  int32_t dy = static_cast<int32_t>(y) - axis_center;
+
+  if (shape == DeadzoneShape::deadzone_axial) {
+    dx = dx < 0 ? -table[-dx] : table[dx];
+    dy = dy < 0 ? -table[-dy] : table[dy];
+  } else {
+    size_t r = static_cast<size_t>(std::sqrt(static_cast<float>(dx * dx + dy * dy)));
+    int64_t gain = table[r < max_radius ? r : max_radius];
+    dx = static_cast<int32_t>((dx * gain) / 65536);
+    dy = static_cast<int32_t>((dy * gain) / 65536);
+  }
+
+  x = Utils::Number::clamp<uint16_t>(dx + axis_center, 0, axis_max);
+  y = Utils::Number::clamp<uint16_t>(dy + axis_center, 0, axis_max);
+}
+
+
+
+PolarProfile::PolarProfile() {
+  clear();
+  start_sampling();
+}
+
+void PolarProfile::start_sampling() {
+  extremes.fill(Point{axis_center, axis_center, 0});
+  seen_min_x = seen_min_y = axis_max;
+  seen_max_x = seen_max_y = 0;
+}
+
+void PolarProfile::sample(uint16_t x, uint16_t y) {
+  seen_min_x = std::min(seen_min_x, x);
+  seen_max_x = std::max(seen_max_x, x);
+  seen_min_y = std::min(seen_min_y, y);
+  seen_max_y = std::max(seen_max_y, y);
+
+  /// The real center isn't known yet, so directions are taken from the middle
+  /// of the range seen so far.
+  int32_t dx = x - (seen_min_x + seen_max_x) / 2;
+  int32_t dy = y - (seen_min_y + seen_max_y) / 2;
+  uint32_t distance_sq = dx * dx + dy * dy;
+  size_t bin = static_cast<size_t>(turn_fraction(dx, dy) * sampling_bins) % sampling_bins;
+  if (distance_sq > extremes[bin].distance_sq) {
+    extremes[bin] = Point{x, y, distance_sq};
+  }
+}
+
+bool PolarProfile::finish(uint16_t center_x, uint16_t center_y) {
+  std::array<uint16_t, bins> found;
+  found.fill(0);
+  for (const Point &point: extremes) {
+    if (point.distance_sq == 0) {
+      continue;
+    }
+    int32_t dx = point.x - center_x;
+    int32_t dy = point.y - center_y;
+    size_t bin = static_cast<size_t>(turn_fraction(dx, dy) * bins) % bins;
+    uint16_t r = static_cast<uint16_t>(std::sqrt(static_cast<float>(dx * dx + dy * dy)));
+    found[bin] = std::max(found[bin], r);
+  }
+
+  /// Directions that weren't reached take the closest ones on each side.
+  size_t filled = std::count_if(found.begin(), found.end(), [](uint16_t r) { return r > 0; });
+  if (filled < bins / 2) {
+    return false;
+  }
+  std::array<uint16_t, bins> radii = found;
+  for (size_t i = 0; i < bins; ++i) {
+    if (found[i] != 0) {
+      continue;
+    }
+    size_t before = 1, after = 1;
+    while (found[(i + bins - before) % bins] == 0) ++before;
+    while (found[(i + after) % bins] == 0) ++after;
+    uint16_t r0 = found[(i + bins - before) % bins];
+    uint16_t r1 = found[(i + after) % bins];
+    radii[i] = static_cast<uint16_t>(r0 + (r1 - r0) * (int32_t)before / (int32_t)(before + after));
+  }
+
+  set(center_x, center_y, radii);
+  return true;
+}
+
+void PolarProfile::clear() {
+  valid = false;
+  radius.fill(0);
+  gain_q16.fill(1 << 16);
+}
+
+bool PolarProfile::is_valid() const {
+  return valid;
+}
+
+void PolarProfile::apply(uint16_t &x, uint16_t &y) const {
+  int32_t dx = x - cx;
+  int32_t dy = y - cy;
+
+  /// Linear interpolation between the two closest directions.
+  float position = turn_fraction(dx, dy) * bins;
+  size_t i = static_cast<size_t>(position) % bins;
+  float t = position - static_cast<float>(static_cast<size_t>(position));
+  int64_t gain = gain_q16[i] + static_cast<int64_t>((gain_q16[(i + 1) % bins] - gain_q16[i]) * t);
+
+  x = Utils::Number::clamp<uint16_t>(((dx * gain) >> 16) + axis_center, 0, axis_max);
+  y = Utils::Number::clamp<uint16_t>(((dy * gain) >> 16) + axis_center, 0, axis_max);
+}
+
+const std::array<uint16_t, PolarProfile::bins> &PolarProfile::radii() const {
+  return radius;
+}
+
+void PolarProfile::set(uint16_t center_x, uint16_t center_y, const std::array<uint16_t, bins> &radii) {
+  cx = center_x;
+  cy = center_y;
+  radius = radii;
+  valid = std::all_of(radius.begin(), radius.end(), [](uint16_t r) { return r > 0; });
+  build_gains();
+}
+
+float PolarProfile::turn_fraction(int32_t dx, int32_t dy) {
+  if (dx == 0 && dy == 0) {
+    return 0.f;
+  }
+  /// atan approximation on [-1, 1], max error ~0.0015 rad.
+  float ax = std::fabs(static_cast<float>(dx)), ay = std::fabs(static_cast<float>(dy));
+  float r = ax > ay ? ay / ax : ax / ay;
+  float angle = (0.7853982f + 0.273f * (1.f - r)) * r;
+  if (ay > ax) angle = 1.5707963f - angle;
+  if (dx < 0) angle = 3.1415927f - angle;
+  if (dy < 0) angle = 6.2831853f - angle;
+
+  float fraction = angle * 0.15915494f;
+  return fraction >= 1.f ? 0.f : fraction;
+}
+
+void PolarProfile::build_gains() {
+  for (size_t i = 0; i < bins; ++i) {
+    gain_q16[i] = radius[i] == 0 ? (1 << 16) : static_cast<int32_t>((StickShaper::half_range << 16) / radius[i]);
+  }
+}
+
+
+void DriftEstimator::reset(uint16_t calibrated_center) {
+  mean_q8 = center_q8 = calibrated_center << 8;
+  reference = calibrated_center;
+  variance_q8 = 0;
+  quiet_reports = 0;
+}
+
+bool DriftEstimator::observe(uint16_t raw) {
+  int32_t value_q8 = raw << 8;
+  int32_t delta = value_q8 - mean_q8;
+  /// Both averages use a 1/16 factor, about 16 reports of memory.
+  mean_q8 += delta / 16;
+  /// Clamped so the square fits in Q8, anything this large isn't resting anyway.
+  int32_t delta_counts = std::clamp(delta >> 8, -0xFF, 0xFF);
+  variance_q8 += ((delta_counts * delta_counts << 8) - variance_q8) / 16;
+
+  return variance_q8 <= (rest_variance << 8) && std::abs(mean_q8 - center_q8) <= (rest_window << 8);
+}
+
+bool DriftEstimator::settle(bool idle) {
+  if (!idle) {
+    quiet_reports = 0;
+    return false;
+  }
+  if (quiet_reports < rest_reports) {
+    ++quiet_reports;
+    return false;
+  }
+
+  int32_t previous = center();
+  /// 1/64 per report, so following a drift takes a few seconds of rest.
+  center_q8 += (mean_q8 - center_q8) / 64;
+  /// A stick held slightly off center must not drag the center along.
+  center_q8 = std::clamp(center_q8, (reference - warn_offset) << 8, (reference + warn_offset) << 8);
+  return center() != previous;
+}
+
+uint16_t DriftEstimator::center() const {
+  return static_cast<uint16_t>((center_q8 + 0x80) >> 8);
+}
+
+int32_t DriftEstimator::drift() const {
+  return center() - reference;
+}
+
+bool DriftEstimator::drifted() const {
+  return std::abs(drift()) >= warn_offset;
+}
+
+
+void RangeLearner::reset(uint16_t center) {
+  min_value = std::max<int32_t>(center - default_reach, 0);
+  max_value = std::min<int32_t>(center + default_reach, axis_max);
+  min_reports = max_reports = 0;
+  built_min = min_value;
+  built_max = max_value;
+}
+
+bool RangeLearner::update(uint16_t raw) {
+  int32_t value = raw;
+  if (value < min_value) {
+    pending_min = min_reports == 0 ? value : std::max(pending_min, value);
+    if (++min_reports >= sustain_reports) {
+      min_value = pending_min;
+      min_reports = 0;
+    }
+  } else {
+    min_reports = 0;
+  }
+  if (value > max_value) {
+    pending_max = max_reports == 0 ? value : std::min(pending_max, value);
+    if (++max_reports >= sustain_reports) {
+      max_value = pending_max;
+      max_reports = 0;
+    }
+  } else {
+    max_reports = 0;
+  }
+
+  if (std::abs(min_value - built_min) < rebuild_step && std::abs(max_value - built_max) < rebuild_step) {
+    return false;
+  }
+  built_min = min_value;
+  built_max = max_value;
+  return true;
+}
+
+uint16_t RangeLearner::min() const {
+  return static_cast<uint16_t>(min_value);
+}
+
+uint16_t RangeLearner::max() const {
+  return static_cast<uint16_t>(max_value);
+}
+
+
+OneEuroFilter::OneEuroFilter(double min_cutoff_hz, double beta_gain, double derivative_cutoff_hz):
+  min_cutoff(min_cutoff_hz), beta(beta_gain), derivative_cutoff(derivative_cutoff_hz) {
+}
+
+double OneEuroFilter::filter(double value, double dt) {
+  if (!initialized || dt <= 0.0) {
+    /// Nothing to smooth against yet, or a duplicated timestamp.
+    if (!initialized) {
+      previous = value;
+      initialized = true;
+    }
+    lag = 0.0;
+    return previous;
+  }
+
+  double derivative = (value - previous) / dt;
+  double a_d = alpha(derivative_cutoff, dt);
+  previous_derivative = a_d * derivative + (1.0 - a_d) * previous_derivative;
+
+  double cutoff = min_cutoff + beta * std::fabs(previous_derivative);
+  double a = alpha(cutoff, dt);
+  previous = a * value + (1.0 - a) * previous;
+  lag = (1.0 - a) / a * dt;
+  return previous;
+}
+
+void OneEuroFilter::reset() {
+  initialized = false;
+  previous_derivative = 0.0;
+  lag = 0.0;
+}
+
+double OneEuroFilter::last_lag() const {
+  return lag;
+}
+
+double OneEuroFilter::alpha(double cutoff, double dt) {
+  double tau = 1.0 / (2.0 * M_PI * cutoff);
+  return 1.0 / (1.0 + tau / dt);
+}
+
+
+Predictor::Predictor(const PredictorSettings &predictor_settings): settings(predictor_settings) {
+}
+
+void Predictor::add(double value, double time) {
+  if (count > 0) {
+    std::pair<double, double> &last = history[(next + history_size - 1) % history_size];
+    if (time <= last.first) {
+      /// Same report twice, keep the newest value.
+      last.second = value;
+      fit();
+      return;
+    }
+  }
+  history[next] = {time, value};
+  next = (next + 1) % history_size;
+  count = std::min(count + 1, history_size);
+  fit();
+}
+
+double Predictor::predict(double time) const {
+  if (count == 0) {
+    return axis_center;
+  }
+  const std::pair<double, double> &last = history[(next + history_size - 1) % history_size];
+  double dt = std::min(std::max(time - last.first, 0.0), settings.horizon);
+  double delta = std::min(std::max(velocity * dt, -settings.clamp), settings.clamp);
+  return std::min(std::max(last.second + delta, 0.0), (double)axis_max);
+}
+
+void Predictor::reset() {
+  count = 0;
+  next = 0;
+  velocity = 0.0;
+}
+
+void Predictor::fit() {
+  if (count < 2) {
+    velocity = 0.0;
+    return;
+  }
+  double mean_t = 0.0, mean_v = 0.0;
+  for (size_t i = 0; i < count; ++i) {
+    mean_t += history[i].first;
+    mean_v += history[i].second;
+  }
+  mean_t /= count;
+  mean_v /= count;
+  double covariance = 0.0, variance = 0.0;
+  for (size_t i = 0; i < count; ++i) {
+    double dt = history[i].first - mean_t;
+    covariance += dt * (history[i].second - mean_v);
+    variance += dt * dt;
+  }
+  velocity = variance > 0.0 ? covariance / variance : 0.0;
+}
@@ -0,0 +1,323 @@
+#pragma once
+#ifndef PRO__STICKS_HPP
+#define PRO__STICKS_HPP
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Sticks {
+  /// Sticks report 12 bit values.
+  constexpr uint16_t axis_max{0xFFF};
+  constexpr uint16_t axis_center{0x7FF};
+  constexpr size_t lut_size{0x1000};
+
+  /**
+   * @brief Maps a raw axis value to its output value with a single load.
+   *
+   * Calibration (min, center and max) and inversion are folded into the
+   * table, so changing any of them only requires rebuilding it.
+   */
+  class AxisLut {
+  public:
+    /// Identity mapping.
+    AxisLut();
+
+    /// Maps [min, cen] to [0, 0x7FF] and [cen, max] to [0x7FF, 0xFFF].
+    void build(uint16_t min, uint16_t cen, uint16_t max, bool invert);
+    /// Leaves the values as they are, only applying the inversion.
+    void build_identity(bool invert);
+
+    uint16_t operator[](uint16_t raw) const {
+      return table[raw & axis_max];
+    }
+
+  private:
+    std::array<uint16_t, lut_size> table;
+  };
+
+
+  enum DeadzoneShape {
+    deadzone_radial,  /// Uses the distance to the center of the stick.
+    deadzone_axial,   /// Each axis on its own.
+  };
+
+  enum CurveType {
+    curve_linear,
+    curve_power,   /// t^param
+    curve_scurve,  /// Flat at both ends, param controls the steepness.
+    curve_points,  /// Piecewise linear through the given points.
+  };
+
+  /// Deadzones and response curve of a stick. Fractions are of the half range.
+  struct StickProfile {
+    DeadzoneShape shape = DeadzoneShape::deadzone_radial;
+    double inner = 0.0;          /// Below this, the output is centered.
+    double outer = 1.0;          /// Above this, the output is at its max.
+    double anti_deadzone = 0.0;  /// Smallest output after leaving the deadzone.
+    CurveType curve = CurveType::curve_linear;
+    double curve_param = 1.0;
+    std::vector<std::pair<double, double>> points;
+
+    bool is_identity() const;
+
+    /// Maps an input magnitude in [0, 1] to an output magnitude in [0, 1].
+    double response(double magnitude) const;
+
+    /**
+     * @brief Parses a curve description: `linear`, `power:EXP`, `scurve:K`
+     * or `points:X:Y,X:Y,...` (with X and Y in [0, 1]).
+     */
+    void set_curve(const std::string &description);
+  };
+
+  /**
+   * @brief Applies a StickProfile to a pair of axes.
+   *
+   * The profile is compiled into a table indexed by the distance to the
+   * center (radial) or by each axis' offset (axial), so transforming a stick
+   * costs one square root and one lookup.
+   */
+  class StickShaper {
+  public:
+    StickShaper();
+
+    void build(const StickProfile &profile);
+
+    /// @param x @param y Mapped values, in [0, 0xFFF]. Updated in place.
+    void apply(uint16_t &x, uint16_t &y) const;
+
+    /// Offset from the center that gives full deflection.
+    static constexpr int32_t half_range{0x800};
+    /// Longest possible distance to the center, at the corners.
+    static constexpr size_t max_radius{2897};
+
+  private:
+    bool identity = true;
+    DeadzoneShape shape = DeadzoneShape::deadzone_radial;
+    /// Radial: gain in Q16 for each radius. Axial: output offset for each input offset.
+    std::array<int32_t, max_radius + 1> table;
+  };
+
+
+  /**
+   * @brief Per-angle maximum radius of a stick, for gates that aren't
+   * circular (or square).
+   *
+   * While calibrating, the farthest point seen in each direction is recorded.
+   * Once the center is known, each report is normalised by the radius of its
+   * direction, found with an atan2 approximation and a table lookup.
+   */
+  class PolarProfile {
+  public:
+    static constexpr size_t bins{64};
+    /// Directions tracked while sampling, before the center is known.
+    static constexpr size_t sampling_bins{4 * bins};
+
+    PolarProfile();
+
+    void start_sampling();
+    void sample(uint16_t x, uint16_t y);
+    /// Builds the profile around the center. Returns false if there weren't
+    /// enough samples.
+    bool finish(uint16_t center_x, uint16_t center_y);
+
+    void clear();
+    bool is_valid() const;
+
+    /**
+     * @brief Normalises a raw stick position so its gate maps to a circle
+     * of full deflection.
+     *
+     * @param x @param y Raw values, updated in place with values in [0, 0xFFF].
+     */
+    void apply(uint16_t &x, uint16_t &y) const;
+
+    const std::array<uint16_t, bins> &radii() const;
+    void set(uint16_t center_x, uint16_t center_y, const std::array<uint16_t, bins> &radii);
+
+    /// Fraction of a turn, in [0, 1), of the direction of (dx, dy).
+    static float turn_fraction(int32_t dx, int32_t dy);
+
+  private:
+    void build_gains();
+
+    bool valid = false;
+    uint16_t cx = axis_center, cy = axis_center;
+    std::array<uint16_t, bins> radius;
+    /// half_range / radius, in Q16.
+    std::array<int32_t, bins> gain_q16;
+
+    struct Point {
+      uint16_t x, y;
+      uint32_t distance_sq;
+    };
+    std::array<Point, sampling_bins> extremes;
+    uint16_t seen_min_x, seen_max_x, seen_min_y, seen_max_y;
+  };
+
+
+  /**
+   * @brief Tracks the resting position of an axis, to follow stick drift
+   * without a full recalibration.
+   *
+   * Keeps exponential moving averages of the value and its variance. After
+   * enough quiet reports close to the current center, the center slowly moves
+   * towards the resting value, but never further than warn_offset from the
+   * calibrated one. All state is a handful of integers.
+   */
+  class DriftEstimator {
+  public:
+    /// Reports the axis must stay quiet before the center starts moving.
+    static constexpr uint32_t rest_reports{60};
+    /// Max variance, in squared raw counts, to consider the axis at rest.
+    static constexpr int32_t rest_variance{16};
+    /// Resting values farther than this from the center are a held stick, not drift.
+    static constexpr int32_t rest_window{0x18};
+    /// Largest drift followed, reaching it is worth a warning.
+    static constexpr int32_t warn_offset{0x60};
+
+    void reset(uint16_t calibrated_center);
+
+    /**
+     * @brief Updates the averages with @param raw, the raw axis value.
+     * @return true if the axis looks at rest.
+     */
+    bool observe(uint16_t raw);
+    /**
+     * @brief Moves the center once the controller was idle long enough.
+     * @param idle False if any button, dpad or other axis is in use.
+     * @return true if the rounded center changed.
+     */
+    bool settle(bool idle);
+
+    uint16_t center() const;
+    /// Distance from the calibrated center to the current estimate.
+    int32_t drift() const;
+    bool drifted() const;
+
+  private:
+    /// Q8 fixed point.
+    int32_t mean_q8 = axis_center << 8;
+    int32_t variance_q8 = 0;
+    int32_t center_q8 = axis_center << 8;
+    int32_t reference = axis_center;
+    uint32_t quiet_reports = 0;
+  };
+
+
+  /**
+   * @brief Learns the range of an axis while it's being used.
+   *
+   * Starts from a conservative range around the center and expands once a
+   * larger deflection is held for a few reports, so a single glitched report
+   * doesn't widen it. The range never shrinks, the reach of a stick doesn't
+   * change while playing.
+   */
+  class RangeLearner {
+  public:
+    /// Default reach from the center, most sticks go a bit further.
+    static constexpr int32_t default_reach{0x500};
+    /// Reports a deflection must last before it widens the range.
+    static constexpr uint32_t sustain_reports{3};
+    /// Change in counts before the tables are worth rebuilding.
+    static constexpr int32_t rebuild_step{4};
+
+    void reset(uint16_t center);
+
+    /// @return true if the range moved enough to rebuild the tables.
+    bool update(uint16_t raw);
+
+    uint16_t min() const;
+    uint16_t max() const;
+
+  private:
+    int32_t min_value = axis_center - default_reach;
+    int32_t max_value = axis_center + default_reach;
+    /// Smallest deflection of the reports past the limit, and how many.
+    int32_t pending_min = 0;
+    int32_t pending_max = 0;
+    uint32_t min_reports = 0;
+    uint32_t max_reports = 0;
+    int32_t built_min = axis_center - default_reach;
+    int32_t built_max = axis_center + default_reach;
+  };
+
+
+  /**
+   * @brief One Euro filter (Casiez et al. 2012). A low-pass filter whose
+   * cutoff grows with the speed of the signal: it smooths jitter at rest
+   * without adding noticeable lag during fast motions.
+   */
+  class OneEuroFilter {
+  public:
+    /**
+     * @param min_cutoff Cutoff at rest, in Hz. Lower removes more jitter.
+     * @param beta How fast the cutoff grows with speed. Higher reduces lag.
+     * @param derivative_cutoff Cutoff used to smooth the speed estimate, in Hz.
+     */
+    OneEuroFilter(double min_cutoff = 1.0, double beta = 0.007, double derivative_cutoff = 1.0);
+
+    /// @param dt Seconds since the previous value.
+    double filter(double value, double dt);
+    void reset();
+
+    /// Lag added to the last value, in seconds. For an exponential smoothing
+    /// step with factor a this is (1 - a) / a * dt.
+    double last_lag() const;
+
+  private:
+    static double alpha(double cutoff, double dt);
+
+    double min_cutoff, beta, derivative_cutoff;
+
+    bool initialized = false;
+    double previous = 0.0;
+    double previous_derivative = 0.0;
+    double lag = 0.0;
+  };
+
+
+  struct PredictorSettings {
+    /// How far past the last report the value is extrapolated, in seconds.
+    double horizon = 0.015;
+    /// Largest distance from the last reported value, in axis counts.
+    double clamp = 0x199;
+  };
+
+  /**
+   * @brief Extrapolates an axis between reports, with the velocity fitted to
+   * the last few of them.
+   *
+   * The extrapolation stops at the horizon and never moves further than the
+   * clamp from the last reported value, so a stick that stops abruptly only
+   * overshoots a bounded amount.
+   */
+  class Predictor {
+  public:
+    static constexpr size_t history_size{4};
+
+    Predictor(const PredictorSettings &settings = PredictorSettings());
+
+    /// @param time Seconds, on any monotonic clock.
+    void add(double value, double time);
+    /// Value at @param time. The last one if there's only one so far.
+    double predict(double time) const;
+    void reset();
+
+  private:
+    /// Least squares slope of the history, in counts per second.
+    void fit();
+
+    PredictorSettings settings;
+    /// Oldest first once full.
+    std::array<std::pair<double, double>, history_size> history{};
+    size_t count = 0;
+    size_t next = 0;
+    double velocity = 0.0;
+  };
+};
+
+#endif
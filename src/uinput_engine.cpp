@@ -0,0 +1,209 @@
+#include "uinput_engine.hpp"
+using namespace VirtualController;
+
+#include <poll.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+
+
+uint64_t IoStats::syscalls() const {
+  return writes + reads;
+}
+
+
+UinputEngine::~UinputEngine() noexcept {
+  if (writer.joinable()) {
+    writer_running = false;
+    batch_ready.notify();
+    writer.join();
+  }
+}
+
+
+void UinputEngine::queue(int fd, unsigned short type, unsigned short code, int value) {
+  Frame *target = &frame(fd);
+  if (target->count == max_events) {
+    flush();
+    /// Nowhere left to merge into, so wait for the writer thread.
+    if (writer_running && target->count == max_events) {
+      hand_over(true);
+    }
+    target = &frame(fd);
+  }
+  struct input_event &event = target->events[target->count++];
+  memset(&event, 0, sizeof(event));
+  gettimeofday(&event.time, NULL);
+  event.type = type;
+  event.code = code;
+  event.value = value;
+}
+
+void UinputEngine::flush() {
+  size_t events = 0;
+  for (const Frame &pending: frames) {
+    events += pending.count;
+  }
+  if (events > 0) {
+    ++io_stats.frames;
+    io_stats.events += events;
+  }
+
+  if (writer_failed) {
+    stop_writer();
+  }
+  if (!writer_running) {
+    send(frames);
+    return;
+  }
+  if (events == 0) {
+    return;
+  }
+  if (!hand_over(false)) {
+    ++io_stats.merged_frames;
+  }
+}
+
+bool UinputEngine::hand_over(bool wait) {
+  while (!batches.try_push(frames)) {
+    if (!wait) {
+      return false;
+    }
+    if (writer_failed) {
+      stop_writer();
+    }
+    std::this_thread::yield();
+  }
+  batch_ready.notify();
+  for (Frame &pending: frames) {
+    pending.count = 0;
+  }
+  return true;
+}
+
+void UinputEngine::watch(int fd) {
+  for (int &slot: watches) {
+    if (slot == fd) {
+      return;
+    }
+  }
+  for (int &slot: watches) {
+    if (slot < 0) {
+      slot = fd;
+      return;
+    }
+  }
+  throw std::length_error("Too many uinput devices watched.");
+}
+
+int UinputEngine::read(int fd, struct input_event &event) {
+  ++io_stats.reads;
+  return ::read(fd, &event, sizeof(event));
+}
+
+const IoStats &UinputEngine::stats() const {
+  return io_stats;
+}
+
+
+void UinputEngine::start_writer(std::function<void(int)> on_readable) {
+  if (writer_running) {
+    return;
+  }
+  readable_callback = on_readable;
+  writer_failed = false;
+  writer_running = true;
+  writer = std::thread(&UinputEngine::writer_loop, this);
+}
+
+void UinputEngine::stop_writer() {
+  if (!writer.joinable()) {
+    return;
+  }
+  writer_running = false;
+  batch_ready.notify();
+  writer.join();
+  if (writer_failed) {
+    writer_failed = false;
+    std::rethrow_exception(writer_error);
+  }
+}
+
+bool UinputEngine::has_writer() const {
+  return writer_running;
+}
+
+void UinputEngine::writer_loop() {
+  std::array<struct pollfd, max_devices + 1> fds;
+  size_t count = 0;
+  fds[count++] = {batch_ready.descriptor(), POLLIN, 0};
+  for (int slot: watches) {
+    if (slot >= 0) {
+      fds[count++] = {slot, POLLIN, 0};
+    }
+  }
+
+  try {
+    bool running = true;
+    while (running) {
+      running = writer_running;
+      if (running && poll(fds.data(), count, 100) < 0 && errno != EINTR) {
+        throw std::system_error(errno, std::generic_category(), "poll() on the uinput devices failed");
+      }
+      if (fds[0].revents & POLLIN) {
+        batch_ready.clear();
+      }
+      while (batches.try_pop(writer_frames)) {
+        send(writer_frames);
+      }
+      for (size_t i = 1; i < count; ++i) {
+        if (fds[i].revents & POLLIN) {
+          readable_callback(fds[i].fd);
+        }
+        fds[i].revents = 0;
+      }
+      fds[0].revents = 0;
+    }
+  }
+  catch (...) {
+    writer_error = std::current_exception();
+    writer_failed = true;
+    writer_running = false;
+  }
+}
+
+
+UinputEngine::Frame &UinputEngine::frame(int fd) {
+  for (Frame &pending: frames) {
+    if (pending.fd == fd) {
+      return pending;
+    }
+  }
+  for (Frame &pending: frames) {
+    if (pending.fd < 0) {
+      pending.fd = fd;
+      return pending;
+    }
+  }
+  throw std::length_error("Too many uinput devices.");
+}
+
+void UinputEngine::send(Batch &batch) {
+  for (Frame &pending: batch) {
+    if (pending.count == 0) {
+      continue;
+    }
+    /// uinput takes any number of events in a single write.
+    ++io_stats.writes;
+    ssize_t ret = ::write(pending.fd, pending.events.data(), pending.count * sizeof(struct input_event));
+    pending.count = 0;
+    if (ret < 0) {
+      throw std::system_error(errno, std::generic_category(), "Failed to write to a uinput device");
+    }
+  }
+}
@@ -0,0 +1,107 @@
+#pragma once
+#ifndef PRO__UINPUT_ENGINE_HPP
+#define PRO__UINPUT_ENGINE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <linux/uinput.h>
+#include "spsc_ring.hpp"
+
+namespace VirtualController {
+  /// Syscalls spent on the uinput devices.
+  struct IoStats {
+    uint64_t frames = 0;
+    uint64_t events = 0;
+    uint64_t writes = 0;
+    uint64_t reads = 0;
+    /// Frames held back and sent with the next one because the writer
+    /// thread fell behind.
+    uint64_t merged_frames = 0;
+
+    uint64_t syscalls() const;
+  };
+
+  /**
+   * @brief Batches the events of every uinput device into frames.
+   *
+   * The events queued during a report are sent by flush(), with a single
+   * write per device.
+   *
+   * With a writer thread, flush() hands the frame over through a ring and
+   * the thread does every read and write on the devices.
+   */
+  class UinputEngine {
+  public:
+    UinputEngine() = default;
+    UinputEngine(const UinputEngine &other) = delete;
+    UinputEngine(UinputEngine &&other) = delete;
+
+    ~UinputEngine() noexcept;
+
+    UinputEngine &operator=(const UinputEngine &other) = delete;
+    UinputEngine &operator=(UinputEngine &&other) = delete;
+
+    /// Queues an event for @param fd. Flushes first if its frame is full.
+    void queue(int fd, unsigned short type, unsigned short code, int value);
+    /// Sends the queued events of every device.
+    void flush();
+
+    /// Polls @param fd for readability from the writer thread, see start_writer().
+    void watch(int fd);
+    /// Same as read(2), counted in the stats.
+    int read(int fd, struct input_event &event);
+
+    /**
+     * @brief Moves the I/O to a separate thread. The devices must be created
+     * and watched before.
+     *
+     * @param on_readable Called from that thread with a watched descriptor
+     * that has something to read.
+     */
+    void start_writer(std::function<void(int)> on_readable);
+    /// Sends what's left and joins the thread.
+    void stop_writer();
+    bool has_writer() const;
+
+    const IoStats &stats() const;
+
+    static constexpr size_t max_devices{4};
+    static constexpr size_t max_events{64};
+
+  private:
+    struct Frame {
+      int fd = -1;
+      size_t count = 0;
+      std::array<struct input_event, max_events> events;
+    };
+    using Batch = std::array<Frame, max_devices>;
+
+    Frame &frame(int fd);
+    /// Gives the pending frames to the writer thread. @param wait blocks
+    /// until it has room, else a full ring leaves them pending.
+    bool hand_over(bool wait);
+    void send(Batch &batch);
+
+    void writer_loop();
+
+    Batch frames;
+    std::array<int, max_devices> watches{-1, -1, -1, -1};
+    IoStats io_stats;
+
+    std::thread writer;
+    std::atomic<bool> writer_running{false};
+    std::function<void(int)> readable_callback;
+    Utils::SpscRing<Batch, 16> batches;
+    Utils::Notifier batch_ready;
+    /// Only used by the writer thread.
+    Batch writer_frames;
+    std::exception_ptr writer_error;
+    std::atomic<bool> writer_failed{false};
+  };
+};
+
+#endif
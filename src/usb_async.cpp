@@ -0,0 +1,299 @@
+#include "usb_async.hpp"
+using namespace HidApi;
+
+#include "hidapi_wrapper.hpp"
+
+#ifdef PROCON_USB_ASYNC
+
+#include <libusb.h>
+#include <algorithm>
+#include <cstring>
+
+
+static std::string usb_error(const char *what, int ret) {
+  return std::string(what) + ": " + libusb_error_name(ret);
+}
+
+AsyncUsbDevice::AsyncUsbDevice(uint16_t vendor_id, uint16_t product_id) {
+  int ret = libusb_init(&context);
+  if (ret < 0) {
+    throw OpenError(usb_error("OpenError: libusb_init()", ret));
+  }
+
+  libusb_device **list = nullptr;
+  ssize_t count = libusb_get_device_list(context, &list);
+  for (ssize_t i = 0; i < count && handle == nullptr; ++i) {
+    struct libusb_device_descriptor descriptor;
+    if (libusb_get_device_descriptor(list[i], &descriptor) < 0
+        || descriptor.idVendor != vendor_id || descriptor.idProduct != product_id) {
+      continue;
+    }
+    if (libusb_open(list[i], &handle) < 0) {
+      handle = nullptr;
+      continue;
+    }
+    libusb_set_auto_detach_kernel_driver(handle, 1);
+    /// Busy if another instance of the driver has it.
+    if (libusb_claim_interface(handle, 0) < 0) {
+      libusb_close(handle);
+      handle = nullptr;
+      continue;
+    }
+    manufacturer_index = descriptor.iManufacturer;
+    product_index = descriptor.iProduct;
+    serial_index = descriptor.iSerialNumber;
+
+    struct libusb_config_descriptor *config = nullptr;
+    if (libusb_get_active_config_descriptor(list[i], &config) == 0) {
+      const struct libusb_interface_descriptor &interface = config->interface[0].altsetting[0];
+      for (uint8_t e = 0; e < interface.bNumEndpoints; ++e) {
+        const struct libusb_endpoint_descriptor &endpoint = interface.endpoint[e];
+        if ((endpoint.bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) != LIBUSB_TRANSFER_TYPE_INTERRUPT) {
+          continue;
+        }
+        if ((endpoint.bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN) {
+          in_endpoint = endpoint.bEndpointAddress;
+        } else {
+          out_endpoint = endpoint.bEndpointAddress;
+        }
+      }
+      libusb_free_config_descriptor(config);
+    }
+  }
+  libusb_free_device_list(list, 1);
+
+  if (handle == nullptr) {
+    close();
+    throw OpenError("OpenError: No free USB device to open.");
+  }
+  if (in_endpoint == 0 || out_endpoint == 0) {
+    close();
+    throw OpenError("OpenError: The device doesn't have interrupt endpoints.");
+  }
+
+  for (size_t i = 0; i < transfers_in_flight; ++i) {
+    transfers[i] = libusb_alloc_transfer(0);
+    if (transfers[i] == nullptr) {
+      close();
+      throw OpenError("OpenError: libusb_alloc_transfer()");
+    }
+    libusb_fill_interrupt_transfer(transfers[i], handle, in_endpoint, buffers[i].data(), buffers[i].size(),
+                                   &AsyncUsbDevice::on_transfer, this, 0);
+    ret = libusb_submit_transfer(transfers[i]);
+    if (ret < 0) {
+      close();
+      throw OpenError(usb_error("OpenError: libusb_submit_transfer()", ret));
+    }
+    ++active;
+  }
+
+  const struct libusb_pollfd **usb_fds = libusb_get_pollfds(context);
+  if (usb_fds != nullptr) {
+    for (size_t i = 0; usb_fds[i] != nullptr; ++i) {
+      fds.push_back({usb_fds[i]->fd, usb_fds[i]->events, 0});
+    }
+    libusb_free_pollfds(usb_fds);
+  }
+}
+
+AsyncUsbDevice::~AsyncUsbDevice() noexcept {
+  close();
+}
+
+void AsyncUsbDevice::close() noexcept {
+  stopping = true;
+  for (size_t i = 0; i < transfers_in_flight; ++i) {
+    if (transfers[i] != nullptr) {
+      libusb_cancel_transfer(transfers[i]);
+    }
+  }
+  /// The transfers can't be freed until their cancellation is reported.
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+  while (active > 0 && std::chrono::steady_clock::now() < deadline) {
+    handle_events(std::chrono::milliseconds(50));
+  }
+  for (struct libusb_transfer *&transfer: transfers) {
+    if (transfer != nullptr && active == 0) {
+      libusb_free_transfer(transfer);
+    }
+    transfer = nullptr;
+  }
+  if (handle != nullptr) {
+    libusb_release_interface(handle, 0);
+    libusb_close(handle);
+    handle = nullptr;
+  }
+  if (context != nullptr && active == 0) {
+    libusb_exit(context);
+  }
+  context = nullptr;
+}
+
+
+void AsyncUsbDevice::on_transfer(struct libusb_transfer *transfer) {
+  AsyncUsbDevice *self = static_cast<AsyncUsbDevice *>(transfer->user_data);
+  switch (transfer->status) {
+  case LIBUSB_TRANSFER_COMPLETED:
+    self->push(transfer->buffer, transfer->actual_length);
+    break;
+  case LIBUSB_TRANSFER_CANCELLED:
+    --self->active;
+    return;
+  case LIBUSB_TRANSFER_NO_DEVICE:
+    self->disconnected = true;
+    --self->active;
+    return;
+  case LIBUSB_TRANSFER_TIMED_OUT:
+    break;
+  default:
+    ++self->usb_stats.errors;
+    break;
+  }
+
+  if (self->stopping || libusb_submit_transfer(transfer) < 0) {
+    --self->active;
+    if (!self->stopping) {
+      self->disconnected = true;
+    }
+  }
+}
+
+void AsyncUsbDevice::push(const uint8_t *data, size_t length) {
+  if (length == 0) {
+    return;
+  }
+  ++usb_stats.received;
+  if (queued == ring_size) {
+    /// Keep the newest reports, the oldest ones are stale anyway.
+    ring_head = (ring_head + 1) % ring_size;
+    --queued;
+    ++usb_stats.overruns;
+  }
+  Report &report = ring[(ring_head + queued) % ring_size];
+  report.length = std::min(length, max_packet_size);
+  report.received = std::chrono::steady_clock::now();
+  memcpy(report.data.data(), data, report.length);
+  ++queued;
+  usb_stats.max_queued = std::max(usb_stats.max_queued, queued);
+}
+
+void AsyncUsbDevice::handle_events(std::chrono::microseconds timeout) {
+  struct timeval tv;
+  tv.tv_sec = timeout.count() / 1000000;
+  tv.tv_usec = timeout.count() % 1000000;
+  libusb_handle_events_timeout_completed(context, &tv, nullptr);
+}
+
+void AsyncUsbDevice::handle_events() {
+  handle_events(std::chrono::microseconds(0));
+}
+
+
+size_t AsyncUsbDevice::write(size_t len, const uint8_t *data) {
+  int transferred = 0;
+  int ret = libusb_interrupt_transfer(handle, out_endpoint, const_cast<uint8_t *>(data), len, &transferred, write_timeout);
+  if (ret < 0) {
+    throw WriteError(usb_error("WriteError: libusb_interrupt_transfer()", ret));
+  }
+  return transferred;
+}
+
+size_t AsyncUsbDevice::read(size_t len, uint8_t *data, int milliseconds) {
+  if (queued == 0) {
+    if (milliseconds < 0) {
+      while (queued == 0 && !disconnected) {
+        handle_events(std::chrono::seconds(1));
+      }
+    } else {
+      handle_events();
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+      while (queued == 0 && !disconnected && std::chrono::steady_clock::now() < deadline) {
+        handle_events(std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()));
+      }
+    }
+  }
+  if (queued == 0) {
+    if (disconnected) {
+      throw ReadError("ReadError: The device was disconnected.");
+    }
+    return 0;
+  }
+
+  const Report &report = ring[ring_head];
+  size_t copied = std::min(len, report.length);
+  memcpy(data, report.data.data(), copied);
+  ring_head = (ring_head + 1) % ring_size;
+  --queued;
+  return copied;
+}
+
+void AsyncUsbDevice::wait_until(std::chrono::steady_clock::time_point deadline) {
+  while (true) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0) {
+      break;
+    }
+    if (poll(fds.data(), fds.size(), remaining) > 0) {
+      handle_events();
+    }
+  }
+}
+
+
+std::string AsyncUsbDevice::get_string(uint8_t index) const {
+  std::array<unsigned char, 256> buf{};
+  if (index == 0 || libusb_get_string_descriptor_ascii(handle, index, buf.data(), buf.size()) < 0) {
+    throw GetterError("GetterError: Couldn't get string " + std::to_string(index) + ".");
+  }
+  return reinterpret_cast<const char *>(buf.data());
+}
+
+#else
+
+AsyncUsbDevice::AsyncUsbDevice(uint16_t, uint16_t) {
+  throw OpenError("OpenError: Built without the native libusb backend (PROCON_USB_ASYNC).");
+}
+
+AsyncUsbDevice::~AsyncUsbDevice() noexcept {
+}
+
+size_t AsyncUsbDevice::write(size_t, const uint8_t *) {
+  return 0;
+}
+
+size_t AsyncUsbDevice::read(size_t, uint8_t *, int) {
+  return 0;
+}
+
+void AsyncUsbDevice::wait_until(std::chrono::steady_clock::time_point) {
+}
+
+void AsyncUsbDevice::handle_events() {
+}
+
+std::string AsyncUsbDevice::get_string(uint8_t) const {
+  return "";
+}
+
+#endif
+
+
+const std::vector<struct pollfd> &AsyncUsbDevice::pollfds() const noexcept {
+  return fds;
+}
+
+std::string AsyncUsbDevice::get_manufacturer() const {
+  return get_string(manufacturer_index);
+}
+
+std::string AsyncUsbDevice::get_product() const {
+  return get_string(product_index);
+}
+
+std::string AsyncUsbDevice::get_serial_number() const {
+  return get_string(serial_index);
+}
+
+const AsyncUsbStats &AsyncUsbDevice::stats() const noexcept {
+  return usb_stats;
+}
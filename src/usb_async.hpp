@@ -0,0 +1,111 @@
+#pragma once
+#ifndef PRO__USB_ASYNC_HPP
+#define PRO__USB_ASYNC_HPP
+
+#include <poll.h>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct libusb_context;
+struct libusb_device_handle;
+struct libusb_transfer;
+
+
+namespace HidApi {
+  struct AsyncUsbStats {
+    uint64_t received = 0;
+    /// Reports lost because the ring was full.
+    uint64_t overruns = 0;
+    /// Failed transfers, they are resubmitted.
+    uint64_t errors = 0;
+    size_t max_queued = 0;
+  };
+
+  /**
+   * @brief Talks to the interrupt endpoints of a USB device with the libusb
+   * async API, without hidapi's reader thread in between.
+   *
+   * Several IN transfers are kept in flight, so a report is never missed while
+   * the previous one is being processed. The completion callback copies each
+   * report into a preallocated ring and resubmits its transfer. Callbacks only
+   * run while handling events, from read() or wait_until(), so the ring isn't
+   * shared between threads.
+   *
+   * Only available when built with PROCON_USB_ASYNC, opening throws otherwise.
+   */
+  class AsyncUsbDevice {
+  public:
+    /// Claims the first device with these ids that isn't in use.
+    AsyncUsbDevice(uint16_t vendor_id, uint16_t product_id);
+    AsyncUsbDevice(const AsyncUsbDevice &other) = delete;
+    AsyncUsbDevice(AsyncUsbDevice &&other) = delete;
+
+    ~AsyncUsbDevice() noexcept;
+
+    AsyncUsbDevice &operator=(const AsyncUsbDevice &other) = delete;
+    AsyncUsbDevice &operator=(AsyncUsbDevice &&other) = delete;
+
+    size_t write(size_t len, const uint8_t *data);
+    /// Pops the oldest report. @param milliseconds 0 doesn't wait, negative waits forever.
+    size_t read(size_t len, uint8_t *data, int milliseconds);
+
+    /// Handles the USB events until @param deadline, queueing the reports that arrive.
+    void wait_until(std::chrono::steady_clock::time_point deadline);
+
+    /// Descriptors to wait on before calling handle_events(). They don't change after opening.
+    const std::vector<struct pollfd> &pollfds() const noexcept;
+    /// Runs the completion callbacks that are ready, without waiting.
+    void handle_events();
+
+    std::string get_string(uint8_t index) const;
+    std::string get_manufacturer() const;
+    std::string get_product() const;
+    std::string get_serial_number() const;
+
+    const AsyncUsbStats &stats() const noexcept;
+
+    static constexpr size_t transfers_in_flight{8};
+    static constexpr size_t ring_size{64};
+    static constexpr size_t max_packet_size{64};
+    static constexpr unsigned int write_timeout{100};
+
+  private:
+    struct Report {
+      size_t length;
+      std::chrono::steady_clock::time_point received;
+      std::array<uint8_t, max_packet_size> data;
+    };
+
+    static void on_transfer(struct libusb_transfer *transfer);
+    void push(const uint8_t *data, size_t length);
+    /// Handles the events for up to @param timeout, or until a callback runs.
+    void handle_events(std::chrono::microseconds timeout);
+    void close() noexcept;
+
+    struct libusb_context *context = nullptr;
+    struct libusb_device_handle *handle = nullptr;
+    uint8_t in_endpoint = 0;
+    uint8_t out_endpoint = 0;
+    uint8_t manufacturer_index = 0;
+    uint8_t product_index = 0;
+    uint8_t serial_index = 0;
+
+    std::array<struct libusb_transfer *, transfers_in_flight> transfers{};
+    std::array<std::array<uint8_t, max_packet_size>, transfers_in_flight> buffers{};
+    size_t active = 0;
+    bool stopping = false;
+    bool disconnected = false;
+
+    std::array<Report, ring_size> ring;
+    size_t ring_head = 0;
+    size_t queued = 0;
+
+    std::vector<struct pollfd> fds;
+    AsyncUsbStats usb_stats;
+  };
+};
+
+#endif
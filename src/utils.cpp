@@ -6,6 +6,8 @@ using namespace Utils;
 #include <vector>
 #include <stdexcept>
 #include <system_error>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 #define KNRM "\x1B[0m"
 #define KRED "\x1B[31m"
@@ -126,3 +128,66 @@ void Str::copy_string_to_char(char *&dst, const char *src) {
 void Str::copy_string_to_char(char *&dst, const std::string &src) {
   copy_string_to_char(dst, src.c_str());
 }
+
+
+
+PeriodicTimer::PeriodicTimer(uint32_t rate): rate_hz(rate) {
+  if (rate_hz == 0) {
+    throw std::invalid_argument("PeriodicTimer(): `rate_hz` can't be zero.");
+  }
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (timer_fd < 0) {
+    throw std::system_error(errno, std::generic_category(), "Failed to create timerfd!");
+  }
+
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  /// tv_nsec must stay below a second, 1 Hz is a whole one.
+  spec.it_interval.tv_sec = 1 / rate_hz;
+  spec.it_interval.tv_nsec = (1000000000L / rate_hz) % 1000000000L;
+  spec.it_value = spec.it_interval;
+  if (timerfd_settime(timer_fd, 0, &spec, nullptr) < 0) {
+    close(timer_fd);
+    throw std::system_error(errno, std::generic_category(), "Failed to arm timerfd!");
+  }
+}
+PeriodicTimer::PeriodicTimer(PeriodicTimer &&other) noexcept: timer_fd(-1) {
+  std::swap(timer_fd, other.timer_fd);
+  std::swap(rate_hz, other.rate_hz);
+}
+
+PeriodicTimer::~PeriodicTimer() noexcept {
+  if (timer_fd >= 0) {
+    close(timer_fd);
+  }
+}
+
+PeriodicTimer &PeriodicTimer::operator=(PeriodicTimer &&other) noexcept {
+  std::swap(timer_fd, other.timer_fd);
+  std::swap(rate_hz, other.rate_hz);
+  return *this;
+}
+
+uint64_t PeriodicTimer::wait() {
+  uint64_t expirations = 0;
+  ssize_t ret = read(timer_fd, &expirations, sizeof(expirations));
+  if (ret != sizeof(expirations)) {
+    if (errno == EINTR) {
+      return 0;
+    }
+    throw std::system_error(errno, std::generic_category(), "Failed to read timerfd!");
+  }
+  return expirations;
+}
+
+int PeriodicTimer::fd() const noexcept {
+  return timer_fd;
+}
+
+uint32_t PeriodicTimer::rate() const noexcept {
+  return rate_hz;
+}
+
+int64_t PeriodicTimer::period_us() const noexcept {
+  return 1000000L / rate_hz;
+}
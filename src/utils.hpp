@@ -2,7 +2,10 @@
 #ifndef UTILS_HPP
 #define UTILS_HPP
 
+#include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <cstdint>
 #include <string>
 #include <sstream>
 #include <iomanip>
@@ -71,6 +74,73 @@ namespace Utils {
       return value;
     }
   }
+
+  /// Running average and maximum of a value.
+  struct Stats {
+    double sum = 0.0;
+    double max = 0.0;
+    uint64_t count = 0;
+
+    void add(double value) {
+      sum += value;
+      if (value > max) max = value;
+      ++count;
+    }
+    double mean() const {
+      return count == 0 ? 0.0 : sum / count;
+    }
+  };
+
+  /// Intervals between events, in milliseconds. Their standard deviation is the jitter.
+  struct IntervalStats {
+    Stats intervals;
+    double sum_squares = 0.0;
+    std::chrono::steady_clock::time_point last;
+
+    void add(std::chrono::steady_clock::time_point now) {
+      if (last.time_since_epoch().count() != 0) {
+        double interval = std::chrono::duration<double, std::milli>(now - last).count();
+        intervals.add(interval);
+        sum_squares += interval * interval;
+      }
+      last = now;
+    }
+    double jitter() const {
+      if (intervals.count == 0) {
+        return 0.0;
+      }
+      double mean = intervals.mean();
+      double variance = sum_squares / intervals.count - mean * mean;
+      return variance > 0.0 ? std::sqrt(variance) : 0.0;
+    }
+  };
+
+  /**
+   * @brief Wrapper around a timerfd that fires @param rate_hz times per second.
+   */
+  class PeriodicTimer {
+  public:
+    PeriodicTimer(uint32_t rate_hz);
+    PeriodicTimer(const PeriodicTimer &other) = delete;
+    PeriodicTimer(PeriodicTimer &&other) noexcept;
+
+    ~PeriodicTimer() noexcept;
+
+    PeriodicTimer &operator=(const PeriodicTimer &other) = delete;
+    PeriodicTimer &operator=(PeriodicTimer &&other) noexcept;
+
+    /// Blocks until the next tick. Returns the amount of ticks elapsed since
+    /// the last call, which is more than one if the caller fell behind.
+    uint64_t wait();
+
+    int fd() const noexcept;
+    uint32_t rate() const noexcept;
+    int64_t period_us() const noexcept;
+
+  private:
+    int timer_fd = -1;
+    uint32_t rate_hz = 0;
+  };
 };
 
 #endif
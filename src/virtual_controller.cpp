@@ -1,16 +1,21 @@
 #include "virtual_controller.hpp"
 using namespace VirtualController;
 
+#include <poll.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <cstring>
 #include <unistd.h>
 #include <errno.h>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
 #include <system_error>
 
 
-Controller::Controller() {
+Controller::Controller(UinputEngine &io_engine): engine(&io_engine) {
   closed = false;
   uinput_fd = open("/dev/uinput", O_RDWR | O_NONBLOCK);
   if (uinput_fd < 0) {
@@ -93,15 +98,21 @@ Controller::Controller() {
     close(uinput_fd);
     throw std::system_error(errno, std::generic_category(), "Failed to create uinput device!");
   }
+  /// Force feedback requests arrive on the same descriptor.
+  engine->watch(uinput_fd);
 }
 
-Controller::Controller(Controller &&other) noexcept:
+Controller::Controller(Controller &&other) noexcept: engine(other.engine),
   uinput_version(std::move(other.uinput_version)), uinput_rc(std::move(other.uinput_rc)),
   uinput_fd(std::move(other.uinput_fd)), rumble_effects(std::move(other.rumble_effects)),
-  closed(std::move(other.closed)) {
+  closed(std::move(other.closed)), pad_state(std::move(other.pad_state)) {
+  other.join_ff_service();
+  other.join_emitter();
 }
 
 Controller::~Controller() noexcept {
+  join_ff_service();
+  join_emitter();
   if (!closed) {
     ioctl(uinput_fd, UI_DEV_DESTROY);
     close(uinput_fd);
@@ -109,88 +120,333 @@ Controller::~Controller() noexcept {
 }
 
 Controller &Controller::operator=(Controller &&other) noexcept {
+  join_ff_service();
+  other.join_ff_service();
+  join_emitter();
+  other.join_emitter();
+  std::swap(engine, other.engine);
   std::swap(uinput_version, other.uinput_version);
   std::swap(uinput_rc, other.uinput_rc);
   std::swap(uinput_fd, other.uinput_fd);
   std::swap(rumble_effects, other.rumble_effects);
   std::swap(closed, other.closed);
+  std::swap(pad_state, other.pad_state);
   return *this;
 }
 
 void Controller::write_single_joystick(int val, int cod) {
-  send_packet(EV_ABS, cod, (int)val);
+  pad_state.axes[cod] = val;
+  if (!fixed_rate) {
+    send_packet(EV_ABS, cod, (int)val);
+  }
 }
 
 void Controller::button_press(int cod) {
-  send_packet(EV_KEY, cod, 1);
+  pad_state.keys[cod] = true;
+  if (!fixed_rate) {
+    send_packet(EV_KEY, cod, 1);
+  }
 }
 
 void Controller::button_release(int cod) {
-  send_packet(EV_KEY, cod, 0);
+  pad_state.keys[cod] = false;
+  if (!fixed_rate) {
+    send_packet(EV_KEY, cod, 0);
+  }
 }
 
 void Controller::send_report() {
+  if (emitter_failed) {
+    stop_fixed_rate();
+  }
+  if (ff_failed) {
+    stop_ff_service();
+  }
+  if (fixed_rate) {
+    queue_key_edges();
+    latest_state.write(pad_state);
+    return;
+  }
   send_packet(EV_SYN, SYN_REPORT, 0);
 }
 
+void Controller::queue_key_edges() {
+  if (queued_keys == pad_state.keys) {
+    return;
+  }
+  for (size_t code = 0; code < pad_state.keys.size(); ++code) {
+    if (queued_keys[code] == pad_state.keys[code]) {
+      continue;
+    }
+    /// What doesn't fit is queued on the next report, so the final state
+    /// always gets through.
+    if (!key_edges.try_push({static_cast<uint16_t>(code), pad_state.keys[code]})) {
+      return;
+    }
+    queued_keys[code] = pad_state.keys[code];
+  }
+}
+
+
+void Controller::start_fixed_rate(uint32_t rate_hz, std::optional<Sticks::PredictorSettings> prediction) {
+  stop_fixed_rate();
+  /// Built here, so a timer that can't be armed is reported to the caller.
+  Utils::PeriodicTimer timer(rate_hz);
+  /// Everything before was already sent.
+  latest_state.write(pad_state);
+  queued_keys = pad_state.keys;
+  KeyEdge stale;
+  while (key_edges.try_pop(stale)) {
+  }
+  emitter_events.reserve(UinputEngine::max_events);
+  emitter_failed = false;
+  fixed_rate = true;
+  emitter = std::thread(&Controller::fixed_rate_loop, this, std::move(timer), prediction);
+}
+
+void Controller::stop_fixed_rate() {
+  join_emitter();
+  if (emitter_failed) {
+    emitter_failed = false;
+    std::rethrow_exception(emitter_error);
+  }
+}
+
+void Controller::join_emitter() noexcept {
+  fixed_rate = false;
+  if (emitter.joinable()) {
+    emitter.join();
+  }
+}
+
+bool Controller::has_fixed_rate() const {
+  return fixed_rate;
+}
+
+void Controller::set_report_time(std::chrono::steady_clock::time_point time) {
+  pad_state.time = time;
+}
+
+OutputStats Controller::output_stats() {
+  std::lock_guard<std::mutex> lock(output_mutex);
+  return fixed_rate_stats;
+}
+
+static double seconds(std::chrono::steady_clock::time_point time) {
+  return std::chrono::duration<double>(time.time_since_epoch()).count();
+}
+
+void Controller::fixed_rate_loop(Utils::PeriodicTimer timer, std::optional<Sticks::PredictorSettings> prediction) {
+  PadState sent;
+  latest_state.read(sent);
+  PadState current = sent;
+  PadState output = sent;
+  std::array<Sticks::Predictor, stick_axes.size()> predictors;
+  if (prediction) {
+    predictors.fill(Sticks::Predictor(*prediction));
+  }
+
+  try {
+    while (fixed_rate) {
+      uint64_t ticks = timer.wait();
+      auto woken = std::chrono::steady_clock::now();
+      bool fresh = latest_state.read(current);
+      if (fresh || prediction) {
+        output = current;
+        if (prediction) {
+          for (size_t i = 0; i < stick_axes.size(); ++i) {
+            if (fresh) {
+              predictors[i].add(current.axes[stick_axes[i]], seconds(current.time));
+            }
+            output.axes[stick_axes[i]] = std::lround(predictors[i].predict(seconds(woken)));
+          }
+        }
+      }
+      /// Key edges are sent even without a new state.
+      bool sent_frame = send_changes(sent, output);
+      sent = output;
+
+      std::lock_guard<std::mutex> lock(output_mutex);
+      fixed_rate_stats.ticks += ticks;
+      fixed_rate_stats.missed_ticks += ticks > 1 ? ticks - 1 : 0;
+      fixed_rate_stats.frames += sent_frame ? 1 : 0;
+      fixed_rate_stats.predicted_frames += (sent_frame && !fresh && prediction) ? 1 : 0;
+      fixed_rate_stats.wakeups.add(woken);
+    }
+    /// The edges queued before stopping.
+    send_changes(sent, sent);
+  }
+  catch (...) {
+    /// Rethrown by the next send_report(), from the input thread.
+    emitter_error = std::current_exception();
+    emitter_failed = true;
+  }
+}
+
+bool Controller::send_changes(const PadState &previous, const PadState &current) {
+  emitter_events.clear();
+  struct input_event event;
+  memset(&event, 0, sizeof(event));
+  gettimeofday(&event.time, NULL);
+
+  std::bitset<KEY_CNT> in_frame;
+  KeyEdge edge;
+  while (key_edges.try_pop(edge)) {
+    /// A press and release in the same frame would cancel out.
+    if (in_frame[edge.code]) {
+      event.type = EV_SYN;
+      event.code = SYN_REPORT;
+      event.value = 0;
+      emitter_events.push_back(event);
+      in_frame.reset();
+    }
+    in_frame[edge.code] = true;
+    event.type = EV_KEY;
+    event.code = edge.code;
+    event.value = edge.pressed;
+    emitter_events.push_back(event);
+  }
+  for (size_t code = 0; code < current.axes.size(); ++code) {
+    if (current.axes[code] != previous.axes[code]) {
+      event.type = EV_ABS;
+      event.code = code;
+      event.value = current.axes[code];
+      emitter_events.push_back(event);
+    }
+  }
+  if (emitter_events.empty()) {
+    return false;
+  }
+  event.type = EV_SYN;
+  event.code = SYN_REPORT;
+  event.value = 0;
+  emitter_events.push_back(event);
+
+  if (write(uinput_fd, emitter_events.data(), emitter_events.size() * sizeof(struct input_event)) < 0) {
+    throw std::system_error(errno, std::generic_category(), "Failed to write to the virtual controller");
+  }
+  return true;
+}
+
 void Controller::update_state() {
   struct input_event uinput_event;
   int ret = get_packet(uinput_event);
   while (ret > 0) {
-    switch (uinput_event.type) {
-    case EV_UINPUT:
-      handle_EV_UINPUT(uinput_event);
-      break;
-
-    case EV_FF:
-      handle_EV_FF(uinput_event);
-      break;
-
-    default:
-      printf("Unkonwn type: %x %x %i\n", uinput_event.type, uinput_event.code, uinput_event.value);
-      break;
-    }
+    handle_event(uinput_event);
     ret = get_packet(uinput_event);
   }
 }
 
-void Controller::update_time(long double delta_milis) {
-  for(RumbleData &rum: rumble_effects) {
-    rum.update_time(delta_milis);
+void Controller::handle_event(const struct input_event &uinput_event) {
+  std::lock_guard<std::mutex> lock(effects_mutex);
+  switch (uinput_event.type) {
+  case EV_UINPUT:
+    handle_EV_UINPUT(uinput_event);
+    break;
+
+  case EV_FF:
+    handle_EV_FF(uinput_event);
+    break;
+
+  default:
+    printf("Unkonwn type: %x %x %i\n", uinput_event.type, uinput_event.code, uinput_event.value);
+    break;
   }
 }
 
-std::array<const RumbleData *, Controller::max_effects> Controller::getRumbleEffects() {
-  std::array<const RumbleData *, max_effects> arr;
-  for (size_t i = 0; i < max_effects; ++i) {
-    arr[i] = &rumble_effects[i];
+void Controller::start_ff_service() {
+  if (ff_running || closed) {
+    return;
+  }
+  /// A thread that failed is still joinable.
+  stop_ff_service();
+  if (!ff_wake) {
+    ff_wake.emplace();
   }
-  return arr;
+  ff_running = true;
+  ff_service = std::thread(&Controller::ff_service_loop, this);
 }
 
-void Controller::send_packet(unsigned short type, unsigned short code, int value){
-  struct input_event uinput_event;
-  memset(&uinput_event, 0, sizeof(uinput_event));
+void Controller::stop_ff_service() {
+  join_ff_service();
+  if (ff_failed) {
+    ff_failed = false;
+    std::rethrow_exception(ff_error);
+  }
+}
+
+void Controller::join_ff_service() noexcept {
+  if (!ff_service.joinable()) {
+    return;
+  }
+  ff_running = false;
+  ff_wake->notify();
+  ff_service.join();
+}
 
-  gettimeofday(&uinput_event.time, NULL);
+FfStats Controller::ff_stats() {
+  std::lock_guard<std::mutex> lock(effects_mutex);
+  return ff_service_stats;
+}
 
-  uinput_event.type = type;
-  uinput_event.code = code;
-  uinput_event.value = value;
+void Controller::ff_service_loop() {
+  std::array<struct pollfd, 2> fds{{{uinput_fd, POLLIN, 0}, {ff_wake->descriptor(), POLLIN, 0}}};
+  while (ff_running) {
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ff_error = std::make_exception_ptr(std::system_error(errno, std::generic_category(), "poll() on the virtual controller failed"));
+      ff_failed = true;
+      ff_running = false;
+      return;
+    }
+    if (fds[1].revents & POLLIN) {
+      ff_wake->clear();
+    }
+    if (!(fds[0].revents & POLLIN)) {
+      continue;
+    }
 
-  int ret = write(uinput_fd, &uinput_event, sizeof(uinput_event));
-  if (ret < 0) {
-    throw std::runtime_error("ERROR: write on virtual controller returned"
-                                + std::to_string(ret) + "\n"
-                                "Maybe try running with sudo.\n"
-                                + strerror(errno) + "\n");
+    auto woken = std::chrono::steady_clock::now();
+    struct input_event uinput_event;
+    while (read(uinput_fd, &uinput_event, sizeof(uinput_event)) == sizeof(uinput_event)) {
+      try {
+        handle_event(uinput_event);
+      }
+      catch (const std::invalid_argument &e) {
+        fprintf(stderr, "%s\n", e.what());
+      }
+      if (uinput_event.type == EV_UINPUT) {
+        double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - woken).count();
+        std::lock_guard<std::mutex> lock(effects_mutex);
+        ++ff_service_stats.requests;
+        ff_service_stats.service_time.add(elapsed);
+      }
+    }
   }
 }
 
+void Controller::update_time(long double delta_milis) {
+  std::lock_guard<std::mutex> lock(effects_mutex);
+  for(RumbleData &rum: rumble_effects) {
+    rum.update_time(delta_milis);
+  }
+}
+
+std::array<RumbleData, Controller::max_effects> Controller::getRumbleEffects() {
+  std::lock_guard<std::mutex> lock(effects_mutex);
+  return rumble_effects;
+}
+
+void Controller::send_packet(unsigned short type, unsigned short code, int value){
+  engine->queue(uinput_fd, type, code, value);
+}
+
 int Controller::get_packet(struct input_event &uinput_event){
   memset(&uinput_event, 0, sizeof(uinput_event));
 
-  int ret = read(uinput_fd, &uinput_event, sizeof(uinput_event));
+  int ret = engine->read(uinput_fd, uinput_event);
   if (ret == 0) {
     throw std::runtime_error("ERROR: read on virtual controller returned"
                                 + std::to_string(ret) + "\n"
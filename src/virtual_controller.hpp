@@ -3,16 +3,64 @@
 #define PRO__VIRTUAL_CONTROLLER_HPP
 
 #include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
 #include <cstdint>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
 #include <linux/uinput.h>
 #include "rumbledata.hpp"
+#include "spsc_ring.hpp"
+#include "sticks.hpp"
+#include "uinput_engine.hpp"
+#include "utils.hpp"
 
 namespace VirtualController {
+  struct FfStats {
+    /// Upload and erase requests answered by the service thread.
+    uint64_t requests = 0;
+    /// From the wake up until the answer, in microseconds.
+    Utils::Stats service_time;
+  };
+
+  /// Last value of every key and axis of the gamepad.
+  struct PadState {
+    std::bitset<KEY_CNT> keys;
+    std::array<int32_t, ABS_CNT> axes{};
+    /// When the report it comes from was received.
+    std::chrono::steady_clock::time_point time;
+  };
+
+  /// A press or release, in the order the reports had them.
+  struct KeyEdge {
+    uint16_t code;
+    bool pressed;
+  };
+
+  struct OutputStats {
+    /// Timer ticks, including the ones missed.
+    uint64_t ticks = 0;
+    uint64_t missed_ticks = 0;
+    /// Ticks that had changes to send.
+    uint64_t frames = 0;
+    /// Frames sent between reports, only with extrapolated sticks.
+    uint64_t predicted_frames = 0;
+    /// Between the wake ups of the emitter.
+    Utils::IntervalStats wakeups;
+  };
+
   class Controller {
   public:
     static constexpr uint16_t max_effects{2};
+    /// Extrapolated by the fixed rate emitter.
+    static constexpr std::array<uint16_t, 4> stick_axes{ABS_X, ABS_Y, ABS_RX, ABS_RY};
 
-    Controller() ;
+    /// The events are sent on @param engine's flush(), which must outlive the controller.
+    Controller(UinputEngine &io_engine);
     Controller(const Controller &other) = delete;
     Controller(Controller &&other) noexcept;
 
@@ -27,13 +75,49 @@ namespace VirtualController {
 
     void button_release(int cod);
 
+    /// Ends a frame. At a fixed rate it only publishes the state for the emitter.
     void send_report();
 
+    /**
+     * @brief Sends the gamepad state from a separate thread @param rate_hz
+     * times per second, instead of on each report.
+     *
+     * The reports only update the latest state, which is handed over with a
+     * triple buffer, and each tick sends what changed since the previous one.
+     * Keys go through a ring instead, so a tap shorter than a tick is still
+     * sent. The other devices aren't affected.
+     *
+     * With @param prediction the sticks are extrapolated on the ticks between
+     * reports, from the times given to set_report_time().
+     */
+    void start_fixed_rate(uint32_t rate_hz, std::optional<Sticks::PredictorSettings> prediction = std::nullopt);
+    /// Joins the emitter, rethrowing its error if it failed.
+    void stop_fixed_rate();
+    bool has_fixed_rate() const;
+    /// Time of the report the next send_report() ends.
+    void set_report_time(std::chrono::steady_clock::time_point time);
+    OutputStats output_stats();
+
+    /// Answers the force feedback requests. Safe to call from another thread.
     void update_state();
 
+    /**
+     * @brief Answers the force feedback requests from a thread that waits on
+     * the uinput descriptor, as soon as they arrive.
+     *
+     * A game's EVIOCSFF ioctl blocks until the upload is answered, so it
+     * shouldn't wait for the next report. update_state() must not be called
+     * while it runs.
+     */
+    void start_ff_service();
+    /// Joins the service, rethrowing its error if it failed.
+    void stop_ff_service();
+    FfStats ff_stats();
+
     void update_time(long double delta_milis);
 
-    std::array<const RumbleData *, max_effects> getRumbleEffects();
+    /// A copy, the effects may be updated from another thread.
+    std::array<RumbleData, max_effects> getRumbleEffects();
 
   private:
     void send_packet(unsigned short type, unsigned short code, int value);
@@ -44,9 +128,51 @@ namespace VirtualController {
 
     void handle_EV_FF(const struct input_event &uinput_event);
 
+    void handle_event(const struct input_event &uinput_event);
+
+    void ff_service_loop();
+    void join_ff_service() noexcept;
+
+    void fixed_rate_loop(Utils::PeriodicTimer timer, std::optional<Sticks::PredictorSettings> prediction);
+    void join_emitter() noexcept;
+    /// Queues the keys that changed since the last call for the emitter.
+    void queue_key_edges();
+    /// Sends the queued key edges and the axes that changed from @param previous
+    /// to @param current in a single write.
+    /// @return false if nothing changed.
+    bool send_changes(const PadState &previous, const PadState &current);
+
+    UinputEngine *engine;
     int uinput_version, uinput_rc, uinput_fd;
     std::array<RumbleData, max_effects> rumble_effects;
+    /// Not moved, each controller has its own. Also guards ff_service_stats.
+    std::mutex effects_mutex;
     bool closed = true;
+
+    /// Not moved either, stopped before moving.
+    std::thread ff_service;
+    std::atomic<bool> ff_running{false};
+    std::optional<Utils::Notifier> ff_wake;
+    FfStats ff_service_stats;
+    /// Rethrown by the next send_report() or stop_ff_service().
+    std::exception_ptr ff_error;
+    std::atomic<bool> ff_failed{false};
+
+    /// Written by the reports, sent as is without a fixed rate.
+    PadState pad_state;
+    /// Not moved either, stopped before moving.
+    std::atomic<bool> fixed_rate{false};
+    std::thread emitter;
+    std::exception_ptr emitter_error;
+    std::atomic<bool> emitter_failed{false};
+    Utils::TripleBuffer<PadState> latest_state;
+    Utils::SpscRing<KeyEdge, 256> key_edges;
+    /// Keys as far as the ring knows, only used by the input thread.
+    std::bitset<KEY_CNT> queued_keys;
+    /// Only used by the emitter.
+    std::vector<struct input_event> emitter_events;
+    std::mutex output_mutex;
+    OutputStats fixed_rate_stats;
   };
 };
 
@@ -0,0 +1,97 @@
+#include "virtual_motion.hpp"
+using namespace VirtualController;
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <cstring>
+#include <unistd.h>
+#include <errno.h>
+#include <string>
+#include <system_error>
+
+
+MotionSensors::MotionSensors(UinputEngine &io_engine): engine(&io_engine) {
+  uinput_fd = open("/dev/uinput", O_RDWR | O_NONBLOCK);
+  if (uinput_fd < 0) {
+    throw std::system_error(errno, std::generic_category(), "Failed to open uinput device!");
+  }
+  closed = false;
+
+  struct uinput_user_dev uinput_device;
+  memset(&uinput_device, 0, sizeof(uinput_device));
+
+  uinput_device.id.bustype = BUS_USB;
+  uinput_device.id.vendor = 0x057e;  // Nintendo
+  uinput_device.id.product = 0x2009; // Pro Controller
+  uinput_device.id.version = 0x110;
+  strncpy(uinput_device.name, "Switch ProController Motion Sensors",
+          UINPUT_MAX_NAME_SIZE);
+
+  ioctl(uinput_fd, UI_SET_PROPBIT, INPUT_PROP_ACCELEROMETER);
+
+  ioctl(uinput_fd, UI_SET_EVBIT, EV_ABS);
+
+  // accelerometer
+  ioctl(uinput_fd, UI_SET_ABSBIT, ABS_X);
+  ioctl(uinput_fd, UI_SET_ABSBIT, ABS_Y);
+  ioctl(uinput_fd, UI_SET_ABSBIT, ABS_Z);
+  // gyroscope
+  ioctl(uinput_fd, UI_SET_ABSBIT, ABS_RX);
+  ioctl(uinput_fd, UI_SET_ABSBIT, ABS_RY);
+  ioctl(uinput_fd, UI_SET_ABSBIT, ABS_RZ);
+
+  for (int code: {ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY, ABS_RZ}) {
+    uinput_device.absmin[code] = INT16_MIN;
+    uinput_device.absmax[code] = INT16_MAX;
+  }
+
+  ioctl(uinput_fd, UI_SET_EVBIT, EV_MSC);
+  ioctl(uinput_fd, UI_SET_MSCBIT, MSC_TIMESTAMP);
+
+  if (write(uinput_fd, &uinput_device, sizeof(uinput_device)) < 0) {
+    close(uinput_fd);
+    closed = true;
+    throw std::system_error(errno, std::generic_category(), "Failed to set motion sensors data!");
+  }
+
+  if (ioctl(uinput_fd, UI_DEV_CREATE) < 0) {
+    close(uinput_fd);
+    closed = true;
+    throw std::system_error(errno, std::generic_category(), "Failed to create motion sensors uinput device!");
+  }
+}
+
+MotionSensors::MotionSensors(MotionSensors &&other) noexcept: engine(other.engine),
+  uinput_fd(std::move(other.uinput_fd)), closed(std::move(other.closed)) {
+  other.closed = true;
+}
+
+MotionSensors::~MotionSensors() noexcept {
+  if (!closed) {
+    ioctl(uinput_fd, UI_DEV_DESTROY);
+    close(uinput_fd);
+  }
+}
+
+MotionSensors &MotionSensors::operator=(MotionSensors &&other) noexcept {
+  std::swap(engine, other.engine);
+  std::swap(uinput_fd, other.uinput_fd);
+  std::swap(closed, other.closed);
+  return *this;
+}
+
+void MotionSensors::send_sample(const std::array<int16_t, 3> &accel, const std::array<int16_t, 3> &gyro, uint32_t timestamp_us) {
+  send_packet(EV_ABS, ABS_X,  accel[0]);
+  send_packet(EV_ABS, ABS_Y,  accel[1]);
+  send_packet(EV_ABS, ABS_Z,  accel[2]);
+  send_packet(EV_ABS, ABS_RX, gyro[0]);
+  send_packet(EV_ABS, ABS_RY, gyro[1]);
+  send_packet(EV_ABS, ABS_RZ, gyro[2]);
+  send_packet(EV_MSC, MSC_TIMESTAMP, static_cast<int>(timestamp_us));
+  send_packet(EV_SYN, SYN_REPORT, 0);
+}
+
+void MotionSensors::send_packet(unsigned short type, unsigned short code, int value) {
+  engine->queue(uinput_fd, type, code, value);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#ifndef PRO__VIRTUAL_MOTION_HPP
+#define PRO__VIRTUAL_MOTION_HPP
+
+#include <array>
+#include <cstdint>
+#include <linux/uinput.h>
+#include "uinput_engine.hpp"
+
+namespace VirtualController {
+  /**
+   * @brief Second uinput device that exposes the accelerometer and the
+   * gyroscope, the same way the kernel's hid-nintendo driver does.
+   * Accelerometer goes to ABS_X/Y/Z and gyroscope to ABS_RX/RY/RZ.
+   */
+  class MotionSensors {
+  public:
+    /// The samples are sent on @param engine's flush(), which must outlive the device.
+    MotionSensors(UinputEngine &io_engine);
+    MotionSensors(const MotionSensors &other) = delete;
+    MotionSensors(MotionSensors &&other) noexcept;
+
+    ~MotionSensors() noexcept;
+
+    MotionSensors &operator=(const MotionSensors &other) = delete;
+    MotionSensors &operator=(MotionSensors &&other) noexcept;
+
+    /**
+     * @brief Sends a single sample, followed by a SYN_REPORT.
+     *
+     * @param timestamp_us Time at which the sample was taken, in microseconds.
+     * Sent as MSC_TIMESTAMP, so it may wrap around.
+     */
+    void send_sample(const std::array<int16_t, 3> &accel, const std::array<int16_t, 3> &gyro, uint32_t timestamp_us);
+
+  private:
+    void send_packet(unsigned short type, unsigned short code, int value);
+
+    UinputEngine *engine;
+    int uinput_fd = -1;
+    bool closed = true;
+  };
+};
+
+#endif
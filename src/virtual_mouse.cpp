@@ -0,0 +1,145 @@
+#include "virtual_mouse.hpp"
+using namespace VirtualController;
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <cmath>
+#include <cstring>
+#include <unistd.h>
+#include <errno.h>
+#include <string>
+#include <system_error>
+#include "utils.hpp"
+
+
+Mouse::Mouse() {
+  uinput_fd = open("/dev/uinput", O_RDWR | O_NONBLOCK);
+  if (uinput_fd < 0) {
+    throw std::system_error(errno, std::generic_category(), "Failed to open uinput device!");
+  }
+
+  struct uinput_user_dev uinput_device;
+  memset(&uinput_device, 0, sizeof(uinput_device));
+
+  uinput_device.id.bustype = BUS_USB;
+  uinput_device.id.vendor = 0x057e;  // Nintendo
+  uinput_device.id.product = 0x2009; // Pro Controller
+  uinput_device.id.version = 0x110;
+  strncpy(uinput_device.name, "Switch ProController Gyro Mouse",
+          UINPUT_MAX_NAME_SIZE);
+
+  // Without buttons it isn't recognized as a mouse.
+  ioctl(uinput_fd, UI_SET_EVBIT, EV_KEY);
+  ioctl(uinput_fd, UI_SET_KEYBIT, BTN_LEFT);
+  ioctl(uinput_fd, UI_SET_KEYBIT, BTN_RIGHT);
+
+  ioctl(uinput_fd, UI_SET_EVBIT, EV_REL);
+  ioctl(uinput_fd, UI_SET_RELBIT, REL_X);
+  ioctl(uinput_fd, UI_SET_RELBIT, REL_Y);
+
+  if (write(uinput_fd, &uinput_device, sizeof(uinput_device)) < 0) {
+    close(uinput_fd);
+    throw std::system_error(errno, std::generic_category(), "Failed to set mouse data!");
+  }
+
+  if (ioctl(uinput_fd, UI_DEV_CREATE) < 0) {
+    close(uinput_fd);
+    throw std::system_error(errno, std::generic_category(), "Failed to create mouse uinput device!");
+  }
+}
+
+Mouse::~Mouse() noexcept {
+  stop_upsampling();
+  ioctl(uinput_fd, UI_DEV_DESTROY);
+  close(uinput_fd);
+}
+
+void Mouse::move(float dx, float dy, int64_t interval_us) {
+  if (!upsampling) {
+    flush(dx, dy);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(pending_mutex);
+  pending_x += dx;
+  pending_y += dy;
+  float ticks = interval_us / (float)tick_us;
+  if (ticks < 1.f) ticks = 1.f;
+  step_x = pending_x / ticks;
+  step_y = pending_y / ticks;
+}
+
+void Mouse::start_upsampling(uint32_t rate_hz) {
+  stop_upsampling();
+  /// Built here, so a timer that can't be armed is reported to the caller.
+  Utils::PeriodicTimer timer(rate_hz);
+  tick_us = 1000000L / rate_hz;
+  upsampling = true;
+  emitter = std::thread(&Mouse::upsampling_loop, this, std::move(timer));
+}
+
+void Mouse::stop_upsampling() {
+  upsampling = false;
+  if (emitter.joinable()) {
+    emitter.join();
+  }
+}
+
+void Mouse::upsampling_loop(Utils::PeriodicTimer timer) {
+  while (upsampling) {
+    try {
+      uint64_t ticks = timer.wait();
+      float dx, dy;
+      {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        dx = step_x * ticks;
+        dy = step_y * ticks;
+        /// Never overshoot what the reports asked for.
+        if (std::fabs(dx) > std::fabs(pending_x)) dx = pending_x;
+        if (std::fabs(dy) > std::fabs(pending_y)) dy = pending_y;
+        pending_x -= dx;
+        pending_y -= dy;
+      }
+      flush(dx, dy);
+    }
+    catch (const std::exception &e) {
+      /// Let move() report the error from the input thread.
+      upsampling = false;
+    }
+  }
+}
+
+void Mouse::flush(float dx, float dy) {
+  remainder_x += dx;
+  remainder_y += dy;
+  int x = static_cast<int>(remainder_x);
+  int y = static_cast<int>(remainder_y);
+  if (x == 0 && y == 0) {
+    return;
+  }
+  remainder_x -= x;
+  remainder_y -= y;
+
+  if (x != 0) send_packet(EV_REL, REL_X, x);
+  if (y != 0) send_packet(EV_REL, REL_Y, y);
+  send_packet(EV_SYN, SYN_REPORT, 0);
+}
+
+void Mouse::send_packet(unsigned short type, unsigned short code, int value) {
+  struct input_event uinput_event;
+  memset(&uinput_event, 0, sizeof(uinput_event));
+
+  gettimeofday(&uinput_event.time, NULL);
+
+  uinput_event.type = type;
+  uinput_event.code = code;
+  uinput_event.value = value;
+
+  int ret = write(uinput_fd, &uinput_event, sizeof(uinput_event));
+  if (ret < 0) {
+    throw std::runtime_error("ERROR: write on mouse device returned"
+                                + std::to_string(ret) + "\n"
+                                + strerror(errno) + "\n");
+  }
+}
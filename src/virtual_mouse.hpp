@@ -0,0 +1,65 @@
+#pragma once
+#ifndef PRO__VIRTUAL_MOUSE_HPP
+#define PRO__VIRTUAL_MOUSE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <linux/uinput.h>
+#include "utils.hpp"
+
+namespace VirtualController {
+  /**
+   * @brief Relative pointer device, used to drive the cursor with the gyro.
+   *
+   * Motion is accumulated with subpixel precision. When upsampling is enabled,
+   * the motion queued by a report is spread over the ticks of a timerfd until
+   * the next report is expected, instead of being sent all at once.
+   */
+  class Mouse {
+  public:
+    Mouse();
+    Mouse(const Mouse &other) = delete;
+    Mouse(Mouse &&other) = delete;
+
+    ~Mouse() noexcept;
+
+    Mouse &operator=(const Mouse &other) = delete;
+    Mouse &operator=(Mouse &&other) = delete;
+
+    /**
+     * @brief Queues relative motion, in pixels.
+     *
+     * @param interval_us Time until the next call is expected. Without
+     * upsampling the motion is sent right away and this is ignored.
+     */
+    void move(float dx, float dy, int64_t interval_us);
+
+    /// Starts emitting at @param rate_hz from a separate thread.
+    void start_upsampling(uint32_t rate_hz);
+    void stop_upsampling();
+
+  private:
+    void upsampling_loop(Utils::PeriodicTimer timer);
+
+    /// Sends the integer part of the accumulated motion, keeping the remainder.
+    void flush(float dx, float dy);
+
+    void send_packet(unsigned short type, unsigned short code, int value);
+
+    int uinput_fd = -1;
+
+    std::mutex pending_mutex;
+    float pending_x = 0.f, pending_y = 0.f;
+    /// Motion released per tick while upsampling.
+    float step_x = 0.f, step_y = 0.f;
+    float remainder_x = 0.f, remainder_y = 0.f;
+
+    std::atomic<bool> upsampling{false};
+    int64_t tick_us = 0;
+    std::thread emitter;
+  };
+};
+
+#endif